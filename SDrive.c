@@ -26,6 +26,7 @@
 #include "display.h"
 #include "atx.h"
 #include "tape.h"
+#include "dirindex.h"
 
 #define SWVERSIONMAJOR  1
 #define SWVERSIONMINOR  0
@@ -56,42 +57,160 @@ const char system_info[] PROGMEM = "SDrive" STR(SWVERSIONMAJOR) STR(SWVERSIONMIN
 //BAUD = Pokey_frq/2/(AUDF+7)		//(16bit register)
 
 #define US_POKEY_DIV_STANDARD	0x28		//#40  => 19040 bps
-						//=> 19231 bps #51
-//#define ATARI_SPEED_STANDARD	(US_POKEY_DIV_STANDARD+11)	//#51 (o sest vic)
-#define ATARI_SPEED_STANDARD	(US_POKEY_DIV_STANDARD+12)*2	//#104 U2X=1
-//#define ATARI_SPEED_STANDARD	(US_POKEY_DIV_STANDARD+6)	//#46 (o sest vic)
-
 #define US_POKEY_DIV_DEFAULT	0x06		//#6   => 68838 bps
+#define US_POKEY_DIV_XF551	0x10		//#16  => 38908 bps, XF551 high speed
+#define US_POKEY_DIV_MAX	US_POKEY_DIV_STANDARD	//end of atari_speed_table
+
+//fastest usable divisor: skip table entries with a larger baud error (0.1 %)
+#ifndef SIO_SPEED_MAX_ERROR
+#define SIO_SPEED_MAX_ERROR	25
+#endif
+
+//USART setting for every pokey divisor: UBRR with U2X=1, or with
+//SIO_SPEED_1X for U2X=0, whichever comes closer to the Atari (NTSC pokey);
+//on a tie U2X=0, it samples 16 times per bit
+//error = (AVR-Atari)/Atari in 0.1 %
+#define SIO_SPEED_1X	0x80
+struct sio_speed {
+	u08 ubrr;
+	signed char error;
+};
 
-#define US_POKEY_DIV_MAX		(255-6)		//pokeydiv 249 => avrspeed 255 (vic nemuze)
-
-const unsigned char atari_speed_table[] PROGMEM = {
-	//avr-UBRR	//pokeydiv: Baud Atari, AVR
-	15,		//0: 127842, 125000
-	17,		//1: 111862, 111111
-	19,		//2: 99433, 100000
-	21,		//3: 89490, 90909
-	24,		//4: 81354, 80000
-	26,		//5: 74575, 74074
-	28,		//6: 68838, 68966
-	30,		//7: 63921, 64516
-	33,		//8: 59660, 58824
-	35,		//9: 55931, 55556
-	37,		//10: 52641, 52632
-	50,		//16(index 11): 38908, 39216
+const struct sio_speed atari_speed_table[US_POKEY_DIV_MAX+1] PROGMEM = {
+	//avr-UBRR	   error	//pokeydiv: Baud Atari, AVR
+#if F_CPU == 14318180
+	{ SIO_SPEED_1X|6,     0 },	//0: 127842, 127841
+	{ SIO_SPEED_1X|7,     0 },	//1: 111862, 111861
+	{ SIO_SPEED_1X|8,     0 },	//2: 99433, 99432
+	{ SIO_SPEED_1X|9,     0 },	//3: 89490, 89489
+	{ SIO_SPEED_1X|10,    0 },	//4: 81354, 81353
+	{ SIO_SPEED_1X|11,    0 },	//5: 74575, 74574
+	{ SIO_SPEED_1X|12,    0 },	//6: 68838, 68837
+	{ SIO_SPEED_1X|13,    0 },	//7: 63921, 63920
+	{ SIO_SPEED_1X|14,    0 },	//8: 59660, 59659
+	{ SIO_SPEED_1X|15,    0 },	//9: 55931, 55930
+	{ SIO_SPEED_1X|16,    0 },	//10: 52641, 52640
+	{ SIO_SPEED_1X|17,    0 },	//11: 49716, 49716
+	{ SIO_SPEED_1X|18,    0 },	//12: 47100, 47099
+	{ SIO_SPEED_1X|19,    0 },	//13: 44745, 44744
+	{ SIO_SPEED_1X|20,    0 },	//14: 42614, 42614
+	{ SIO_SPEED_1X|21,    0 },	//15: 40677, 40677
+	{ SIO_SPEED_1X|22,    0 },	//16: 38908, 38908
+	{ SIO_SPEED_1X|23,    0 },	//17: 37287, 37287
+	{ SIO_SPEED_1X|24,    0 },	//18: 35796, 35795
+	{ SIO_SPEED_1X|25,    0 },	//19: 34419, 34419
+	{ SIO_SPEED_1X|26,    0 },	//20: 33144, 33144
+	{ SIO_SPEED_1X|27,    0 },	//21: 31961, 31960
+	{ SIO_SPEED_1X|28,    0 },	//22: 30858, 30858
+	{ SIO_SPEED_1X|29,    0 },	//23: 29830, 29830
+	{ SIO_SPEED_1X|30,    0 },	//24: 28868, 28867
+	{ SIO_SPEED_1X|31,    0 },	//25: 27965, 27965
+	{ SIO_SPEED_1X|32,    0 },	//26: 27118, 27118
+	{ SIO_SPEED_1X|33,    0 },	//27: 26320, 26320
+	{ SIO_SPEED_1X|34,    0 },	//28: 25568, 25568
+	{ SIO_SPEED_1X|35,    0 },	//29: 24858, 24858
+	{ SIO_SPEED_1X|36,    0 },	//30: 24186, 24186
+	{ SIO_SPEED_1X|37,    0 },	//31: 23550, 23550
+	{ SIO_SPEED_1X|38,    0 },	//32: 22946, 22946
+	{ SIO_SPEED_1X|39,    0 },	//33: 22372, 22372
+	{ SIO_SPEED_1X|40,    0 },	//34: 21827, 21826
+	{ SIO_SPEED_1X|41,    0 },	//35: 21307, 21307
+	{ SIO_SPEED_1X|42,    0 },	//36: 20812, 20811
+	{ SIO_SPEED_1X|43,    0 },	//37: 20339, 20338
+	{ SIO_SPEED_1X|44,    0 },	//38: 19887, 19886
+	{ SIO_SPEED_1X|45,    0 },	//39: 19454, 19454
+	{ SIO_SPEED_1X|46,    0 },	//40: 19040, 19040
+#else	//16MHz
+	{ SIO_SPEED_1X|7,   -22 },	//0: 127842, 125000
+	{ SIO_SPEED_1X|8,    -7 },	//1: 111862, 111111
+	{ SIO_SPEED_1X|9,     6 },	//2: 99433, 100000
+	{ SIO_SPEED_1X|10,   16 },	//3: 89490, 90909
+	{ 24,               -17 },	//4: 81354, 80000
+	{ 26,                -7 },	//5: 74575, 74074
+	{ 28,                 2 },	//6: 68838, 68966
+	{ 30,                 9 },	//7: 63921, 64516
+	{ SIO_SPEED_1X|16,  -14 },	//8: 59660, 58824
+	{ SIO_SPEED_1X|17,   -7 },	//9: 55931, 55556
+	{ SIO_SPEED_1X|18,    0 },	//10: 52641, 52632
+	{ SIO_SPEED_1X|19,    6 },	//11: 49716, 50000
+	{ SIO_SPEED_1X|20,   11 },	//12: 47100, 47619
+	{ 44,                -7 },	//13: 44745, 44444
+	{ 46,                -1 },	//14: 42614, 42553
+	{ 48,                 3 },	//15: 40677, 40816
+	{ 50,                 8 },	//16: 38908, 39216
+	{ SIO_SPEED_1X|26,   -7 },	//17: 37287, 37037
+	{ SIO_SPEED_1X|27,   -2 },	//18: 35796, 35714
+	{ SIO_SPEED_1X|28,    2 },	//19: 34419, 34483
+	{ SIO_SPEED_1X|29,    6 },	//20: 33144, 33333
+	{ 62,                -7 },	//21: 31961, 31746
+	{ 64,                -3 },	//22: 30858, 30769
+	{ 66,                 1 },	//23: 29830, 29851
+	{ 68,                 4 },	//24: 28868, 28986
+	{ SIO_SPEED_1X|35,   -7 },	//25: 27965, 27778
+	{ SIO_SPEED_1X|36,   -3 },	//26: 27118, 27027
+	{ SIO_SPEED_1X|37,    0 },	//27: 26320, 26316
+	{ SIO_SPEED_1X|38,    3 },	//28: 25568, 25641
+	{ SIO_SPEED_1X|39,    6 },	//29: 24858, 25000
+	{ 82,                -4 },	//30: 24186, 24096
+	{ 84,                -1 },	//31: 23550, 23529
+	{ 86,                 2 },	//32: 22946, 22989
+	{ 88,                 4 },	//33: 22372, 22472
+	{ SIO_SPEED_1X|45,   -4 },	//34: 21827, 21739
+	{ SIO_SPEED_1X|46,   -1 },	//35: 21307, 21277
+	{ SIO_SPEED_1X|47,    1 },	//36: 20812, 20833
+	{ SIO_SPEED_1X|48,    3 },	//37: 20339, 20408
+	{ 100,               -4 },	//38: 19887, 19802
+	{ 102,               -2 },	//39: 19454, 19417
+	{ 104,                0 },	//40: 19040, 19048
+#endif
 };
 
+#define ATARI_SPEED_STANDARD	sio_speed(US_POKEY_DIV_STANDARD)
+
+//USART_Init() value for the pokey divisor
+u16 sio_speed(u08 pokeydiv)
+{
+	u08 ubrr = pgm_read_byte(&atari_speed_table[pokeydiv].ubrr);
+
+	if (ubrr & SIO_SPEED_1X)
+		return (ubrr & ~SIO_SPEED_1X) | USART_1X;
+	return ubrr;
+}
+
+//the divisor itself or the next slower one the AVR can meet
+u08 sio_usable_pokeydiv(u08 pokeydiv)
+{
+	signed char e;
+
+	for (; pokeydiv < US_POKEY_DIV_MAX; pokeydiv++) {
+		e = pgm_read_byte(&atari_speed_table[pokeydiv].error);
+		if (e >= -SIO_SPEED_MAX_ERROR && e <= SIO_SPEED_MAX_ERROR)
+			break;
+	}
+	return pokeydiv;
+}
+
+//XF551 high speed: a disk command with bit 7 set gets its ACK at the
+//standard speed, C/E and the data frames at US_POKEY_DIV_XF551
+u08 xf551_speed;
+
+void send_disk_ACK(void)
+{
+	send_ACK();
+	if (xf551_speed)
+		USART_Init(sio_speed(US_POKEY_DIV_XF551));
+}
+
 unsigned char debug = 0;
-unsigned char mmc_sector_buffer[512];	// one SD sector
 unsigned char atari_sector_buffer[256];
 u08 atari_sector_status = 0xff;
 u16 last_angle_returned;
+int16_t last_angle_deviation;
 
 ////does not work correctly any more, don't know why?
 ////But we have enaugh RAM free yet
 //#define FileFindBuffer (atari_sector_buffer+256-11)		//pri vyhledavani podle nazvu
 char FileFindBuffer[11];
-char DebugBuffer[20];
 
 struct GlobalSystemValues GS;
 struct FileInfoStruct FileInfo;			//< file information for last file accessed
@@ -100,6 +219,9 @@ extern struct display tft;
 extern unsigned char actual_page;
 extern unsigned char file_selected;
 extern struct file_save image_store[] EEMEM;
+void mount_save(unsigned char drive);		//mount records, mount.c
+unsigned char mount_restore(unsigned char drive);
+extern u16 gBytesPerSector;	//ATX sector size
 
 uint8_t system_atr_name[] EEMEM = "SDRIVE  ATR";  //8+3 zamerne deklarovano za system_info,aby bylo pripadne v dosahu pres get status
 //
@@ -311,8 +433,11 @@ struct SDriveParameters sdrparams;
 void process_command();	//define, because it's after main!
 
 void sio_debug (char status) {
+	char DebugBuffer[28];	//on the stack, the command paths to here are short
+
 	//print the last cmd
-	sprintf_P(DebugBuffer, PSTR("%.2x %.2x %.2x %.2x %c %u"), cmd_buf.dev, cmd_buf.cmd, cmd_buf.aux1, cmd_buf.aux2, status, last_angle_returned);
+	//with the ATX sector angle and how far the head was off when it was sent
+	sprintf_P(DebugBuffer, PSTR("%.2x %.2x %.2x %.2x %c %u %d"), cmd_buf.dev, cmd_buf.cmd, cmd_buf.aux1, cmd_buf.aux2, status, last_angle_returned, last_angle_deviation);
 	outbox(DebugBuffer);
 }
 
@@ -320,6 +445,9 @@ void sio_debug (char status) {
 #define blanker_on()	TIMSK2 & _BV(TOIE2)
 
 unsigned char blank_count = 0;
+volatile unsigned char blank_draw;	//what the main loop has to draw:
+#define BLANK_MOVE	1		// the name to a new place
+#define BLANK_REDRAW	2		// the page again
 
 void blanker_start () {
 	TFT_fill(Black);
@@ -330,12 +458,20 @@ void blanker_start () {
 void blanker_stop () {
 	TIMSK2 &= ~_BV(TOIE2);	//interrupt disable
 	TCCR2B = 0;		//stop
-	tft.pages[actual_page].draw();	//redraw page
+	blank_draw = BLANK_REDRAW;	//redraw page
 }
 
 ISR(TIMER2_OVF_vect) {
 	blank_count++;
-	if (blank_count % 64 == 0) {
+	if (blank_count % 64 == 0)
+		blank_draw = BLANK_MOVE;
+}
+
+void blanker_draw () {
+	unsigned char d = blank_draw;
+
+	blank_draw = 0;		//a new one may come while we draw
+	if (d == BLANK_MOVE) {
 		unsigned int x = rand() % 120;
 		unsigned int y = rand() % 300;
 		//unsigned int col = rand() * rand();
@@ -343,6 +479,67 @@ ISR(TIMER2_OVF_vect) {
 		TFT_fill(Black);
 		print_str_P(x,y,2,Orange,Black, system_name);
 	}
+	else
+		tft.pages[actual_page].draw();
+}
+
+//The ui works with atari_sector_buffer, the card, the display and the
+//vDisk structs like a command from the Atari does, so it masks the
+//command interrupt (only that one) and lets a waiting command in at
+//sio_yield(), where it is between two of those things: after a list
+//entry, a button or a row of a big fill.  Returns 1 if a command came,
+//it may have drawn.
+#define ui_begin()	PCICR &= ~(1<<PCIE1)
+#define ui_end()	PCICR |= (1<<PCIE1)
+
+unsigned char ui_command;	//the ui runs process_command(), cmd_buf is its
+
+//stack a command takes on top of the ui (the ATX sector write down to the
+//card and the UDRE interrupt), a yield deeper in the ui lets none in
+#define SIO_STACK	256
+
+unsigned int stack_room ()
+{
+#ifdef __AVR__
+	extern char __heap_start;	//end of the static RAM
+	return SP - (unsigned int) &__heap_start;
+#else
+	return SIO_STACK;
+#endif
+}
+
+unsigned char sio_yield ()
+{
+	if ((PCICR & (1<<PCIE1)) || !(PCIFR & (1<<PCIF1)) || !(SREG & (1<<SREG_I)) || ui_command)
+		return 0;	//not masked, nothing came, or in a command
+	if (stack_room() < SIO_STACK)
+		return 0;	//a shallower yield or ui_end() serves it
+	ui_end();		//the interrupt comes here
+	ui_begin();
+	//its frame goes out of atari_sector_buffer (FileNameBuffer) or the cache
+	USART_Wait_Tx();
+	mmc_cache_busy = 0;
+	return 1;
+}
+
+//a step of the sorted index build (a directory sector or a few records),
+//the command interrupt masked as in the ui; so that a command frame waits
+//no longer than a few sector reads, the write-back of the step before is
+//a step on its own and none starts while the card still programs
+void index_step ()
+{
+	USART_Wait_Tx();	//the frame may still go out of the cache
+	ui_begin();
+	if (mmcWriteBusy())
+		;		//the next time
+	else if (mmcCacheDirty())
+		mmcWriteCachedFlush();
+	else {
+		FileInfo.vDisk = &tmpvDisk;
+		if (dirIndexStep())
+			list_files_sorted();
+	}
+	ui_end();
 }
 
 //drive motor simulation
@@ -369,6 +566,21 @@ ISR(TIMER1_COMPA_vect) {
 		motor_off();
 }
 
+//8+3 name of the image in atari_sector_buffer to the drive button
+void drive_button_name(unsigned char drive)
+{
+	struct button *bp;
+	char *name;
+
+	pretty_name((char*) atari_sector_buffer);
+	bp = &tft.pages[PAGE_MAIN].buttons[drive];
+	name = pgm_read_ptr(&bp->name);
+	strncpy(&name[3], (char*)atari_sector_buffer, 12);
+	//redraw display only, if we are on main page
+	if(actual_page == PAGE_MAIN)
+		draw_Buttons();
+}
+
 //----- Begin Code ------------------------------------------------------------
 int main(void)
 {
@@ -400,8 +612,11 @@ int main(void)
 	FileInfo.percomstate=0;		//inicializace
 	//fastsio_pokeydiv=US_POKEY_DIV_DEFAULT;		//default fastsio
 	fastsio_pokeydiv=eeprom_read_byte(&system_fastsio_pokeydiv_default); //definovano v EEPROM
+	if (fastsio_pokeydiv>US_POKEY_DIV_MAX) fastsio_pokeydiv=US_POKEY_DIV_DEFAULT;
+	fastsio_pokeydiv=sio_usable_pokeydiv(fastsio_pokeydiv);
 
 	tft_Setup();
+	TFT_yield = sio_yield;	//big fills let the Atari in
 	tft.pages[PAGE_MAIN].draw();	//draw main page
 	if(tft.cfg.boot_d1)
 		actual_drive_number = 1;
@@ -458,6 +673,12 @@ int main(void)
 		goto ST_IDLE;
 	}
 
+	//SDRIVE.IDX in the root dir
+	FileInfo.vDisk = &tmpvDisk;
+	tmpvDisk.dir_cluster=RootDirCluster;
+	if (!dirIndexInit() && tft.cfg.sort)
+		outbox_P(PSTR("no SDRIVE.IDX: unsorted"));
+
 	//restore images from eeprom
 	{
 		unsigned char i;
@@ -465,12 +686,19 @@ int main(void)
 					// to avoid each button redraw
 		//only D1-D4, but we must start 0-indexed for the eeprom-array
 		for(i = 0; i < DEVICESNUM-1; i++) {
+			//the entry of the mount record is still the same file?
+			if (mount_restore(i+1)) {
+				drive_button_name(i+1);
+				if (vDisk[i+1].flags & FLAGS_ATXTYPE)
+					loadAtxFile();
+				continue;
+			}
 			tmpvDisk.dir_cluster = eeprom_read_dword(&image_store[i].dir_cluster);
 			if (tmpvDisk.dir_cluster != 0xffffffff) {
 				cmd_buf.aux = eeprom_read_word(&image_store[i].file_index);
 				cmd_buf.cmd = (0xF0 | (i+1));	//set drive
 				cmd_buf.dev = 0x71;	//say we are a sdrive cmd
-				process_command();	//set image to drive
+				process_command();	//set image to drive, a new mount record
 			}
 		}
 		actual_page = PAGE_MAIN;	//clear the fake
@@ -490,6 +718,15 @@ SET_SDRIVEATR_TO_D0:	//pro nastaveni SDRIVE.ATR do vD0: bez zmeny actual_drive_n
 		unsigned short i;
 		unsigned char m;
 
+		//still there, where it was the last time?
+		if(mount_restore(0) && FileInfo.vDisk->dir_cluster==RootDirCluster)
+		{
+			for(m=0;m<11;m++)	//8+3
+				if(atari_sector_buffer[m]!=eeprom_read_byte(&system_atr_name[m])) break;
+			if(m==11) goto find_sdrive_atr_finished;
+		}
+		FileInfo.vDisk->dir_cluster=RootDirCluster;
+
 		i=0;
 		while( fatGetDirEntry(i,0) )
 		{
@@ -503,8 +740,7 @@ SET_SDRIVEATR_TO_D0:	//pro nastaveni SDRIVE.ATR do vD0: bez zmeny actual_drive_n
 			}
 
 			//Slava, nasel SDRIVE.ATR
-			FileInfo.vDisk->current_cluster=FileInfo.vDisk->start_cluster;
-			FileInfo.vDisk->ncluster=0;
+			fatMapClusterRuns();
 			//FileInfo.vDisk->file_index = i; //dela se uvnitr fatGetDirEntry
 
 			faccess_offset(FILE_ACCESS_READ,0,16); //ATR hlavicka vzdy
@@ -515,14 +751,13 @@ SET_SDRIVEATR_TO_D0:	//pro nastaveni SDRIVE.ATR do vD0: bez zmeny actual_drive_n
 
 			{
 				unsigned long compute;
-				unsigned long tmp;
 
 				compute = FileInfo.vDisk->size - 16;		//je to vzdy ATR
-				tmp = (FileInfo.vDisk->flags & FLAGS_ATRDOUBLESECTORS)? 0x100:0x80;
-				compute /=tmp;
+				compute >>= ATR_SECTOR_SHIFT(FileInfo.vDisk->flags);
 
 				if(compute>720) FileInfo.vDisk->flags|=FLAGS_ATRMEDIUMSIZE;
 			}
+			mount_save(0);	//for the next time
 			goto find_sdrive_atr_finished;
 			//
 find_sdrive_atr_next_entry:
@@ -568,9 +803,11 @@ ST_IDLE:
 		unsigned int (*b_func)(struct button *);
 		unsigned int de;
 		unsigned char drive_number;
-		char *name;
+		char *name, letter;
 
-		if (isTouching()) {
+		if (touchPoll()) {
+			//the buttons work on atari_sector_buffer, let a frame go out first
+			USART_Wait_Tx();
 			if(blanker_on()) {
 				blanker_stop();
 				goto bad_touch;
@@ -580,19 +817,20 @@ ST_IDLE:
 				//get pointers
 				flags = pgm_read_ptr(&b->flags);
 				name = pgm_read_ptr(&b->name);
+				letter = flags->ram ? name[0] : pgm_read_byte(name);
 
-				cli();	//no interrupts so long we work on vDisk struct
+				ui_begin();	//no commands so long we work on vDisk struct
 				//display use tmp struct
 				FileInfo.vDisk = &tmpvDisk;
 				//remember witch D*-button on main page
 				// we have pressed
-				if(actual_page == PAGE_MAIN && name[0] == 'D')
+				if(actual_page == PAGE_MAIN && letter == 'D')
 					drive_number = b-tft.pages[PAGE_MAIN].buttons;
 				//read and...
 				b_func = pgm_read_ptr(&b->pressed);
 				//...call the buttons function
 				de = b_func(b);
-				sei();
+				ui_end();
 				//check if actual_drive has changed
 				if (actual_drive_number != drive_number && flags->selected) {
 					actual_drive_number = drive_number;
@@ -602,7 +840,9 @@ ST_IDLE:
 					set_display(actual_drive_number);
 				}
 				if(de) {	//if a direntry was returned
-					cli();
+					USART_Wait_Tx();
+					ui_begin();	//a command that came meanwhile is served first
+					sio_yield();
 					//was it the deactivation flag?
 					if(de == -1) { // &&
 					   //(vDisk[drive_number].flags & FLAGS_DRIVEON)) {
@@ -615,12 +855,14 @@ ST_IDLE:
 						cmd_buf.aux = de;
 					}
 					cmd_buf.dev = 0x71;	//say we are a sdrive cmd
+					ui_command = 1;		//its draws let no command in
 					process_command();
-					sei();
+					ui_command = 0;
+					ui_end();
 				}
 				//it was the N[ew]-Button? Create new file
 				//(reset is done in deactivate drive)
-				if(actual_page == PAGE_MAIN && name[0] == 'N' &&
+				if(actual_page == PAGE_MAIN && letter == 'N' &&
 				   actual_drive_number != 0) {
 					vDisk[actual_drive_number].flags |= (FLAGS_ATRNEW);	// | FLAGS_DRIVEON);
 					b = &tft.pages[PAGE_MAIN].buttons[actual_drive_number];
@@ -629,7 +871,7 @@ ST_IDLE:
 					draw_Buttons();
 				}
 				//tape mode?
-				if(actual_page == PAGE_TAPE && name[0] == 'S') {
+				if(actual_page == PAGE_TAPE && letter == 'S') {
 					struct button *pb = &tft.pages[actual_page].buttons[1];
 					struct b_flags *pause = pgm_read_ptr(&pb->flags);
 					if(tape_flags.run || pause->selected) {	//Stop
@@ -661,13 +903,21 @@ ST_IDLE:
 					}
 				}
 				sfp = atari_sector_buffer;
-				//if matched, wait for button release
-bad_touch:			while (isTouching());
-				_delay_ms(50);	//wait a little for debounce
 			}
-			sleep = 0;	//reset display blank timer
+			//the next touch after the release, see touchPoll()
+bad_touch:		sleep = 0;	//reset display blank timer
+		}
+
+		if (blank_draw) {
+			ui_begin();
+			blanker_draw();
+			ui_end();
 		}
 
+		//the sorted index, a step at a time between the commands
+		if (dirIndexBusy())
+			index_step();
+
 		if(tape_flags.run) {
 			cli();	//no interrupts during tape operation
 			if(tape_flags.FUJI)
@@ -722,7 +972,9 @@ bad_touch:			while (isTouching());
 			if (sleep > DISPLAY_IDLE) {
 				if (!blanker_on() ) {
 					//start blanker via timer 2
+					ui_begin();
 					blanker_start();
+					ui_end();
 				}
 			}
 			else
@@ -741,8 +993,18 @@ ISR(PCINT1_vect)
 	if(CMD_PORT & (1<<CMD_PIN))	//do nothing on high
 		return;
 
-	if(blanker_on())		//this is not optimal here, should be
-		blanker_stop();		// done after ACK
+	touchAbort();			//we may draw, the lines back to the display
+
+	USART_Wait_Tx();		//rest of the last frame (only if the Atari gave up on it)
+	mmc_cache_busy = 0;		//so no cache line is in use for sending
+
+	if (xf551_speed) {		//the command frame comes at the normal speed again
+		xf551_speed = 0;
+		USART_Init(sio_speed(fastsio_active? fastsio_pokeydiv : US_POKEY_DIV_STANDARD));
+	}
+
+	if(blanker_on())		//the main loop draws the page again
+		blanker_stop();
 
 	FileInfo.vDisk = vp;		//restore vDisk pointer
 
@@ -797,19 +1059,7 @@ void process_command ()
 
 change_sio_speed_by_fastsio_active:
 			{
-			 u08 as;
-			 as=ATARI_SPEED_STANDARD;	//default speed
-			 //if (fastsio_active) as=fastsio_pokeydiv+6;		//always about 6 vic
-			 if (fastsio_active) {
-					//for pokeydiv 16(a. o.) use index 11
-					if(fastsio_pokeydiv > 10)
-						as = pgm_read_byte(&atari_speed_table[11]);
-					//all others are linear
-					else
-						as = pgm_read_byte(&atari_speed_table[fastsio_pokeydiv]);
-			 }
-
-			 USART_Init(as);
+			 USART_Init(sio_speed(fastsio_active? fastsio_pokeydiv : US_POKEY_DIV_STANDARD));
 			}
 			return;
 		}
@@ -821,6 +1071,12 @@ change_sio_speed_by_fastsio_active:
 
 	if( cmd_buf.dev>=0x31 && cmd_buf.dev<(0x30+DEVICESNUM) ) //D1: to D4: (yes, from D1: !!!)
 	{
+		if (cmd_buf.cmd & 0x80)	//XF551 high speed command
+		{
+			cmd_buf.cmd &= 0x7f;
+			xf551_speed = 1;
+		}
+
 		// Only D1: from D4: (from 0x31 to 0x34)
 		// But via the SDrive (0x71 to 0x74 by the sdrive number)
 		// always approach to vD0:
@@ -876,7 +1132,7 @@ disk_operations_direct_d0_d4:
 			 u32 singlesize = IMSIZE1;
 			 if (FileInfo.vDisk->flags & FLAGS_ATRNEW) {	//create new image
 				u08 err;
-				send_ACK();
+				send_disk_ACK();
 				LED_RED_ON(virtual_drive_number); // LED on
 				motor_on();
 				if (FileInfo.percomstate == 2)	//XXX: Could not work until image exists!
@@ -934,31 +1190,15 @@ format_medium:
 					//set_display(virtual_drive_number);
 				}
 				else {
-					send_ACK();
+					send_disk_ACK();
 					LED_RED_ON(virtual_drive_number); // LED on
 				}
 
 				formaterror=0;
 
-				{
-				 //Resets the formatted file
-				 Clear_atari_sector_buffer_256();
-				 {
-				  unsigned long maz,psize;
-				  maz=0;
-				  if ( !(FileInfo.vDisk->flags & FLAGS_XFDTYPE) ) maz+=16;
-				  while( (psize=(FileInfo.vDisk->size-maz))>0 )
-				  {
-				   if (psize>256) psize=256;
-				   if (!faccess_offset(FILE_ACCESS_WRITE,maz,(u16)psize))
-				   {
+				//Resets the formatted file (behind the ATR header)
+				if (faccess_zero( (FileInfo.vDisk->flags & FLAGS_XFDTYPE) ? 0 : 16 ))
 					formaterror=1; //Failed to write
-					break;
-				   }
-				   maz+=psize;
-				  }
-				 }
-				}
 				
 				//Predicts the values 0xff or 0x00 in the return sector (what returns the format command)
 				//and set FLAGS_WRITEERROR on error
@@ -987,7 +1227,7 @@ format_medium:
 		case 0x22: // format medium
 			// 	Formats medium density on an Atari 1050. Format medium density cannot be achieved via PERCOM block settings!
 			if (FileInfo.vDisk->flags & FLAGS_ATRNEW) {	//create new image
-				send_ACK();
+				send_disk_ACK();
 				LED_RED_ON(virtual_drive_number); // LED on
 				motor_on();
 				if(newFile(IMSIZE2))
@@ -1046,7 +1286,7 @@ Send_NACK_and_ST_IDLE:
 		}
 device_command_accepted:
 
-		send_ACK();
+		send_disk_ACK();
 //			Delay1000us();	//delay_us(COMMAND_DELAY);
 
 		switch(cmd_buf.cmd)
@@ -1173,7 +1413,11 @@ bytes 9-11 Drive interface type string "IDE"
 
 			//FOURBYTESTOLONG(atari_sector_buffer+8)=fs; //DEBUG !!!!!!!!!!!
 
-			fs/=((u32)secsize); //convert filesize to sectors
+			//convert filesize to sectors
+			if ( isxex )
+			 fs/=((u32)secsize);
+			else
+			 fs>>=ATR_SECTOR_SHIFT(FileInfo.vDisk->flags);
 
 			atari_sector_buffer[2] = ((fs>>8) & 0xff);	//hb sectors
 			atari_sector_buffer[3] = (fs & 0xff );		//lb sectors
@@ -1252,11 +1496,25 @@ percom_prepared:
                 if(FileInfo.vDisk->flags & FLAGS_ATXTYPE)
                 {
 		    //Load track info table on each drive change, it's fast enough and needs only one buffer.
-		    //Good for now, if more then read is implemented, this should be done before!
+		    //Done before a write gets its data, it uses atari_sector_buffer!
 		    if (last_drive_accessed != virtual_drive_number) {
 			loadAtxFile();	// TODO: check return value
 			last_drive_accessed = virtual_drive_number;
 		    }
+                    if(cmd_buf.cmd!=0x52)
+                    {
+                        //write to the sector in place
+                        if (USART_Get_atari_sector_buffer_and_check_and_send_ACK_or_NACK(gBytesPerSector))
+                        {
+                            break;
+                        }
+			motor_on();
+
+                        if (!saveAtxSector(n_sector, &atari_sector_status)) {
+                            goto Send_ERR_and_Delay;
+                        }
+                        goto Send_CMPL_and_Delay;
+                    }
                     if (!loadAtxSector(n_sector, &atari_sector_size, &atari_sector_status)) {
                         goto Send_ERR_and_DATA;
                     }
@@ -1274,9 +1532,17 @@ percom_prepared:
                     }
                     else
                     {
-                        //sector 4 or greater
-                        atari_sector_size = (FileInfo.vDisk->flags & FLAGS_ATRDOUBLESECTORS)? ((unsigned short)0x100):((unsigned short)0x80);	//FileInfo.vDisk->atr_sector_size;
-                        n_data_offset = (u32) ( ((u32)(((u32)n_sector)-4) ) * ((u32)atari_sector_size)) + ((u32)384);
+                        //sector 4 or greater, shifted by a constant (byte moves) instead of a 32 bit multiplication
+                        if(FileInfo.vDisk->flags & FLAGS_ATRDOUBLESECTORS)
+                        {
+                            atari_sector_size = (unsigned short)0x100;
+                            n_data_offset = (((u32)(n_sector-4)) << 8) + ((u32)384);
+                        }
+                        else
+                        {
+                            atari_sector_size = (unsigned short)0x80;
+                            n_data_offset = (((u32)(n_sector-4)) << 7) + ((u32)384);
+                        }
                     }
 
                     //ATR or XFD?
@@ -1285,6 +1551,15 @@ percom_prepared:
                     if(cmd_buf.cmd==0x52)
                     {
                         //read
+                        //send straight out of the sector cache, if it can
+                        {
+                            struct faccess_part part[2];
+                            if(faccess_map(n_data_offset,atari_sector_size,part))
+                            {
+                                USART_Send_Data_and_check_sum(part[0].ptr,part[0].len,part[1].ptr,part[1].len,0);
+                                break;
+                            }
+                        }
                         proceeded_bytes = faccess_offset(FILE_ACCESS_READ,n_data_offset,atari_sector_size);
                         if(proceeded_bytes==0)
                         {
@@ -1531,19 +1806,21 @@ Send_ERR_and_DATA:
 
 		case 0xC0:	//$C0 xl xh	Get 20 filenames from xhxl. 8.3 + attribute (11+1)*20+1 [<241]
 					//		+1st byte of filename 21 (+1)
+					//		xhxl | $8000 => from position xhxl of the sorted view
 			{
 				u08 i,j;
 				u08 *spt,*dpt;
 				u16 fidx;
-				Clear_atari_sector_buffer_256();
 				//fidx=TWOBYTESTOWORD(command+2); //cmd_buf.aux1,[3]
 				fidx=cmd_buf.aux;
+				if (fidx & DIRINDEX_SORTED) dirIndexUpdate();
+				Clear_atari_sector_buffer_256();
 				dpt=atari_sector_buffer+12;
 				i=21;
 				while(1)
 				{	
 					i--;
-					if (!fatGetDirEntry(fidx++,0)) break;
+					if (!fatGetDirEntry(dirIndexEntry(fidx++),0)) break;
 					//8+3+ukonceni0
 					spt=atari_sector_buffer;
 					if (!i)
@@ -1568,7 +1845,7 @@ Send_ERR_and_DATA:
 		case 0xC1:	//$C1 nn ??	set fastsio pokey divisor
 			
 			if (cmd_buf.aux1>US_POKEY_DIV_MAX) goto Send_ERR_and_Delay;
-			fastsio_pokeydiv = cmd_buf.aux1;
+			fastsio_pokeydiv = sio_usable_pokeydiv(cmd_buf.aux1);	//$3F tells the Atari
 			fastsio_active=0;	//zmenila se rychlost, musi prejit na standardni
 			
 			/*
@@ -1590,8 +1867,22 @@ Send_ERR_and_DATA:
 			bootloader_relocation = cmd_buf.aux1;
 			goto Send_CMPL_and_Delay;
 
+		case 0xC3:	//$C3 xl xh	Find the first filename from index xhxl starting with the prefix sent by $EC n 0 (11 bytes, 0 terminated
+				//if shorter, any case, of the long name or NAME.EXT) in actual directory, get filename 8.3+attribute+fileindex [14]
+
+			if (dirIndexFind(FileFindBuffer,cmd_buf.aux)==DIRINDEX_NOTFOUND) goto Command_ED_notfound;
+			goto Command_ED_found;
+
 		//--------------------------------------------------------------------------
 
+		case 0xD9:	//$D9  n ??	Get SD cache statistics hits,misses,writes (3x u32). n<>0 => reset them afterwards [<12]
+			{
+				memcpy(atari_sector_buffer,&mmc_stats,sizeof(struct mmc_cache_stats));
+				if (cmd_buf.aux1) memset(&mmc_stats,0,sizeof(struct mmc_cache_stats));
+				USART_Send_cmpl_and_atari_sector_buffer_and_check_sum(sizeof(struct mmc_cache_stats));
+			}
+			break;
+
 		case 0xDA:	//get system values
 			{
 				u08 *sptr,*dptr;
@@ -1600,16 +1891,16 @@ Send_ERR_and_DATA:
 				//
 				//Globalni sada promennych
 				sptr=(u08*)&GS;
-				i=sizeof(struct GlobalSystemValues);	//13
+				i=GS_INFO_SIZE;					//25, without the shifts
 				do { *dptr++=*sptr++; i--; } while(i>0);
 				//tzv. lokalni vDisk
 				//sptr=(u08*)&FileInfo.vDisk;
 				sptr=(u08*)FileInfo.vDisk;
-				i=sizeof(virtual_disk_t);				//15
+				i=VDISK_INFO_SIZE;				//23, without the cluster runs
 				do { *dptr++=*sptr++; i--; } while(i>0);
 
-				//celkem 26 bytu
-				USART_Send_cmpl_and_atari_sector_buffer_and_check_sum( (sizeof(struct GlobalSystemValues)+sizeof(virtual_disk_t)) );
+				//celkem 48 bytu
+				USART_Send_cmpl_and_atari_sector_buffer_and_check_sum( (GS_INFO_SIZE+VDISK_INFO_SIZE) );
 			}				
 			break;
 
@@ -1655,12 +1946,9 @@ Send_ERR_and_DATA:
 			Delay800us();	//t5
 			send_CMPL();
 			Delay800us();	//t6
-			{
-			 u08 check_sum;
-			 check_sum = get_checksum(mmc_sector_buffer,512);
-			 USART_Send_Buffer(mmc_sector_buffer,512);
-			 USART_Transmit_Byte(check_sum);
-			}
+			//checksummed on the way, 513th byte
+			mmc_cache_busy |= 1<<mmc_cache_line;
+			USART_Send_Block(mmc_sector_buffer,512,1);
 			//USART_Send_cmpl_and_atari_sector_buffer_and_check_sum(atari_sector_size); //nelze pouzit protoze checksum je 513. byte (prelezl by ven z bufferu)
 			break;
 
@@ -1785,11 +2073,13 @@ Command_ED_notfound:	//sem skoci z commandu ED kdyz nenajde hledany nazev soubor
 
 		case 0xE4: 	//$E4 xl xh	Get filename xhxl. 8.3 + attribute [11+1=12]
 		case 0xE5:	//$E5 xl xh	Get more detailed filename xhxl. 8.3 + attribute + size/date/time [11+1+8=20]
+				//xhxl | $8000 => position xhxl of the sorted view (also $E6-$E9, $F0-$FF)
 		   {
 			unsigned char ret,len;
 			//ret=fatGetDirEntry((cmd_buf.aux1+(cmd_buf.aux2<<8)),0);
 			//ret=fatGetDirEntry(TWOBYTESTOWORD(command+2),0);
-			ret=fatGetDirEntry(cmd_buf.aux,0);
+			if (cmd_buf.aux & DIRINDEX_SORTED) dirIndexUpdate();
+			ret=fatGetDirEntry(dirIndexEntry(cmd_buf.aux),0);
 
 			if (0)
 			{
@@ -1912,8 +2202,9 @@ Command_ED_found:	//sem skoci z commandu ED kdyz najde hledane filename a chce v
 			unsigned short i;
 
 			i=0;
+			if (cmd_buf.aux & DIRINDEX_SORTED) dirIndexUpdate();
 			//if (fatGetDirEntry(TWOBYTESTOWORD(command+2),1))
-			if (fatGetDirEntry(cmd_buf.aux,1))
+			if (fatGetDirEntry(dirIndexEntry(cmd_buf.aux),1))
 			{
 			 //nasel, takze se posune i-ckem az na konec longname
 			 while(atari_sector_buffer[i++]!=0);	//!!!!!!!!!!!!!!!!! pokud by longname melo 256 znaku, zasekne se to tady!!! Bacha!!!
@@ -1930,8 +2221,7 @@ Command_ED_found:	//sem skoci z commandu ED kdyz najde hledane filename a chce v
 		case 0xEA:	//$EA ?? ??	Get number of items in actual directory [<2]
 		   {
 			unsigned short i;
-			i=0;
-			while (fatGetDirEntry(i,0)) i++;
+			i=fatCountDirEntries();
 			//TWOBYTESTOWORD(atari_sector_buffer+0)=i;	//0,1
 			TWOBYTESTOWORD((u16*)asb32_p)=i;	//0,1
 			USART_Send_cmpl_and_atari_sector_buffer_and_check_sum(2);
@@ -2010,7 +2300,7 @@ Command_ED_found:	//sem skoci z commandu ED kdyz najde hledane filename a chce v
 				   // If (m<>0) set fileOrdirectory to vDn:
 
 			//FileFindBuffer <> atari_sector_buffer !!!
-			if (USART_Get_buffer_and_check_and_send_ACK_or_NACK(FileFindBuffer,11))
+			if (USART_Get_buffer_and_check_and_send_ACK_or_NACK((unsigned char*)FileFindBuffer,11))
 			{
 				break;
 			}
@@ -2180,8 +2470,9 @@ Command_ED_found:	//sem skoci z commandu ED kdyz najde hledane filename a chce v
 				FileInfo.vDisk->dir_cluster=tmpvDisk.dir_cluster;
 			}
 
+			if (cmd_buf.aux & DIRINDEX_SORTED) dirIndexUpdate();
 			//ret=fatGetDirEntry(TWOBYTESTOWORD(command+2),0); //2,3
-			ret=fatGetDirEntry(cmd_buf.aux,0); //2,3
+			ret=fatGetDirEntry(dirIndexEntry(cmd_buf.aux),0); //2,3
 
 			if(ret)
 			{
@@ -2194,8 +2485,7 @@ Command_EC_F0_FF_found:
 				else
 				{
 					//Aktivuje soubor
-					FileInfo.vDisk->current_cluster=FileInfo.vDisk->start_cluster;
-					FileInfo.vDisk->ncluster=0;
+					fatMapClusterRuns();
 					//reset flags except ATRNEW
 					FileInfo.vDisk->flags &= FLAGS_ATRNEW;
 
@@ -2205,7 +2495,6 @@ Command_EC_F0_FF_found:
 					{
 						// ATR
 						unsigned long compute;
-						unsigned long tmp;
 
 						faccess_offset(FILE_ACCESS_READ,0,16); //je to ATR
 								
@@ -2215,8 +2504,7 @@ Command_EC_F0_FF_found:
 							FileInfo.vDisk->flags|=FLAGS_ATRDOUBLESECTORS;
 
 						compute = FileInfo.vDisk->size - 16;		//je to ATR
-						tmp = (FileInfo.vDisk->flags & FLAGS_ATRDOUBLESECTORS)? 0x100:0x80;		//FileInfo.vDisk->atr_sector_size;
-						compute /=tmp;
+						compute >>= ATR_SECTOR_SHIFT(FileInfo.vDisk->flags);
 						if(compute>720) FileInfo.vDisk->flags|=FLAGS_ATRMEDIUMSIZE; //atr_medium_size = 0x80;
 					}
 					else
@@ -2279,17 +2567,13 @@ Set_XEX:					// XEX
 					}
 
 					if(drive && drive < DEVICESNUM) {
-						//set new filename to button
-						fatGetDirEntry(cmd_buf.aux,0);
-						pretty_name((char*) atari_sector_buffer);
-						bp = &tft.pages[PAGE_MAIN].buttons[drive];
-						name = pgm_read_ptr(&bp->name);
-						strncpy(&name[3], (char*)atari_sector_buffer, 12);
-						//redraw display only, if we are on
-						//main page
-						if(actual_page == PAGE_MAIN)
-							draw_Buttons();
+						//set new filename to button, the entry found
+						//above (aux may be a sorted index position)
+						fatGetDirEntry(FileInfo.vDisk->file_index,0);
+						drive_button_name(drive);
 					}
+					if(drive < DEVICESNUM)
+						mount_save(drive);	//for the next boot
 
 				}
 
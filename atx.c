@@ -20,14 +20,12 @@
 //*****************************************************************************
 
 #include <stdlib.h>
-#include <util/delay.h>
+#include <stddef.h>
 #include "avrlibtypes.h"
 #include "fat.h"
 #include "atx.h"
 #include "atx_avr.h"
 
-// number of angular units in a full disk rotation
-#define AU_FULL_ROTATION         26042
 // number of angular units to read one sector
 #define AU_ONE_SECTOR_READ       1208
 // number of ms for each angular unit
@@ -46,26 +44,51 @@
 #define MS_HEAD_SETTLE_1050      40
 // mask for checking FDC status "data lost" bit
 #define MASK_FDC_DLOST           0x04
+// mask for checking FDC status "CRC error" bit
+#define MASK_FDC_CRC             0x08
 // mask for checking FDC status "missing" bit
 #define MASK_FDC_MISSING         0x10
 // mask for checking FDC status extended data bit
 #define MASK_EXTENDED_DATA       0x40
 
+// milliseconds converted to angular units for scheduling on the rotation timer
+#define AU_MS(ms)                ((u32) ((ms) / MS_ANGULAR_UNIT_VAL))
+
 #define MAX_RETRIES_1050         1
 #define MAX_RETRIES_810          4
 
+// track header flag of an MFM (enhanced or double density) track
+#define ATX_TRACK_MFM            0x02
+
 struct atxTrackInfo {
-    u32 offset;   // absolute position within file for start of track header
+    u08 number;   // track number of the record (0-based)
+    u16 size;     // size of the record, the next one follows right behind
+};
+
+struct atxTrackCache {
+    u08 track;    // track number the cache holds (as gCurrentHeadTrack), 0 = empty
+    u16 first;    // number of the first sector on that track
+    u16 count;    // number of sectors of the track, 0 if the track is not present
+    u32 offset;   // absolute position of the track header
+    u32 list;     // absolute position of the first sector header
+    u32 chunks;   // absolute position of the first track chunk
+    struct atxCachedSector sector[ATX_CACHE_SECTORS];
 };
 
 extern unsigned char atari_sector_buffer[256];
 extern u16 last_angle_returned; // extern so we can display it on the screen
+extern int16_t last_angle_deviation;    // reached minus wanted head position of the last sector read
 
 u16 gBytesPerSector;                                 // number of bytes per sector
 u08 gSectorsPerTrack;                                // number of sectors in each track
-struct atxTrackInfo gTrackInfo[MAX_TRACK];                  // pre-calculated info for each track
+u08 gDensity;                                        // density of the disk from the file header
+u08 gMfmTracks;                                      // the file flags MFM tracks, so FM ones are too
+u08 gTrackCount;                                     // number of track records in the file
+u32 gTrackStart;                                     // absolute position of the first track record
+struct atxTrackInfo gTrackInfo[MAX_TRACK];           // the track records in file order
 u16 gLastAngle;
 u08 gCurrentHeadTrack;
+struct atxTrackCache gTrackCache;                    // sector list of the actual head track
 
 u16 loadAtxFile() {
     struct atxFileHeader *fileHeader;
@@ -88,15 +111,17 @@ u16 loadAtxFile() {
         return 0;
     }
 
-    // enhanced density is 26 sectors per track, single and double density are 18
-    gSectorsPerTrack = (fileHeader->density == 1) ? (u08) 26 : (u08) 18;
+    // enhanced density (1) is 26 sectors per track, single (0) and double density (2) are 18
+    gDensity = fileHeader->density;
+    gSectorsPerTrack = (gDensity == 1) ? (u08) 26 : (u08) 18;
     // single and enhanced density are 128 bytes per sector, double density is 256
-    gBytesPerSector = (fileHeader->density == 1) ? (u16) 256 : (u16) 128;
+    gBytesPerSector = (gDensity == 2) ? (u16) 256 : (u16) 128;
 
-    // calculate track offsets
-    u32 startOffset = fileHeader->startData;
-    u08 track;
-    for (track = 0; track < MAX_TRACK; track++) {
+    // collect the track records, tracks may be missing or stored in any order
+    u32 startOffset = gTrackStart = fileHeader->startData;
+    gTrackCount = 0;
+    gMfmTracks = 0;
+    while (gTrackCount < MAX_TRACK) {
         if (!faccess_offset(FILE_ACCESS_READ, startOffset, sizeof(struct atxTrackHeader))) {
             break;
         }
@@ -105,112 +130,278 @@ u16 loadAtxFile() {
 #ifndef __AVR__ // note that byte swapping is not needed on AVR platforms, so we remove the calls to conserve resources
         byteSwapAtxTrackHeader(trackHeader);
 #endif
-        gTrackInfo[track].offset = startOffset;
+        // a track record is far below 64k
+        if (!trackHeader->size || trackHeader->size > 0xFFFF) {
+            break;
+        }
+        gTrackInfo[gTrackCount].number = trackHeader->trackNumber;
+        gTrackInfo[gTrackCount].size = (u16) trackHeader->size;
+        gTrackCount++;
+        if (trackHeader->flags & ATX_TRACK_MFM) {
+            gMfmTracks = 1;
+        }
         startOffset += trackHeader->size;
     }
 
+    // the cached sector list belongs to the previous image
+    gTrackCache.track = 0;
+
     return gBytesPerSector;
 }
 
-u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status) {
-    struct atxTrackHeader *trackHeader;
-    struct atxSectorListHeader *slHeader;
+// the track, sector list and chunk headers below are read to the stack, atari_sector_buffer
+// holds the data of a sector write until it is written
+
+// walks the track chunks for the weak data record of a sector index and returns its weak
+// offset, -1 if there is none (with clear set, its weak data is removed from the file first)
+static int16_t atxScanChunks(u08 index, u08 clear) {
+    struct atxTrackChunk chunk;
+    struct atxTrackChunk *extSectorData = &chunk;
+    u32 currentFileOffset = gTrackCache.chunks;
+    int16_t weakOffset = -1;
+
+    // note that we stop looking for chunks when we hit the 8-byte terminator; length == 0
+    do {
+        if (!faccess_read(currentFileOffset, (u08 *) &chunk, sizeof(struct atxTrackChunk))) {
+            break;
+        }
+#ifndef __AVR__
+        byteSwapAtxTrackChunk(extSectorData);
+#endif
+        if (extSectorData->size > 0) {
+            if (extSectorData->type == 0x10 && extSectorData->sectorIndex == index) {
+                if (clear) {
+                    // weak data starting behind the sector data is none,
+                    // the record keeps its place in the track
+                    extSectorData->data = gBytesPerSector;
+#ifndef __AVR__
+                    byteSwapAtxTrackChunk(extSectorData);
+#endif
+                    faccess_write(currentFileOffset, (u08 *) &chunk, sizeof(struct atxTrackChunk));
+#ifndef __AVR__
+                    byteSwapAtxTrackChunk(extSectorData);
+#endif
+                }
+                weakOffset = extSectorData->data;
+            }
+            currentFileOffset += extSectorData->size;
+        }
+    } while (extSectorData->size > 0);
+
+    return weakOffset;
+}
+
+// reads the track header and sector list of a track into the cache
+static void atxCacheTrack(u08 track) {
+    union {
+        struct atxTrackHeader track;
+        struct atxSectorListHeader list;
+        struct atxSectorHeader sector[sizeof(struct atxTrackHeader) / sizeof(struct atxSectorHeader)];
+    } header;
+    struct atxTrackHeader *trackHeader = &header.track;
+    struct atxSectorListHeader *slHeader = &header.list;
     struct atxSectorHeader *sectorHeader;
-    struct atxTrackChunk *extSectorData;
+    u16 i, j, n;
+
+    gTrackCache.track = track;
+    gTrackCache.first = (track - 1) * gSectorsPerTrack + 1;
+    gTrackCache.count = 0;
+
+    // find the record of the track
+    u32 currentFileOffset = gTrackStart;
+    u08 r;
+    for (r = 0; r < gTrackCount && gTrackInfo[r].number != track - 1; r++) {
+        currentFileOffset += gTrackInfo[r].size;
+    }
+    // track not present
+    if (r == gTrackCount) {
+        return;
+    }
+    gTrackCache.offset = currentFileOffset;
+    if (!faccess_read(currentFileOffset, (u08 *) &header, sizeof(struct atxTrackHeader))) {
+        return;
+    }
+#ifndef __AVR__
+    byteSwapAtxTrackHeader(trackHeader);
+#endif
+    // if there are no sectors in this track or the track number doesn't match, leave it empty
+    if (trackHeader->trackNumber != track - 1 || !trackHeader->sectorCount) {
+        return;
+    }
+    // the drive can't read a track in the other encoding (FM for single density, MFM else),
+    // only checked if the file flags the encoding at all
+    if (gMfmTracks && !(trackHeader->flags & ATX_TRACK_MFM) != !gDensity) {
+        return;
+    }
+    u16 sectorCount = trackHeader->sectorCount;
+
+    // read the sector list header
+    currentFileOffset += trackHeader->headerSize;
+    gTrackCache.chunks = currentFileOffset;
+    if (!faccess_read(currentFileOffset, (u08 *) &header, sizeof(struct atxSectorListHeader))) {
+        return;
+    }
+#ifndef __AVR__
+    byteSwapAtxSectorListHeader(slHeader);
+#endif
+
+    // sector list header is variable length, so skip any extra header bytes that may be present
+    currentFileOffset += slHeader->next - sectorCount * sizeof(struct atxSectorHeader);
+    gTrackCache.list = currentFileOffset;
+    gTrackCache.count = sectorCount;
+
+    // read the sector headers, as many as fit into the header buffer at once
+    for (i = 0; i < sectorCount && i < ATX_CACHE_SECTORS; i += n) {
+        n = sizeof(header) / sizeof(struct atxSectorHeader);
+        if (n > sectorCount - i) {
+            n = sectorCount - i;
+        }
+        if (n > ATX_CACHE_SECTORS - i) {
+            n = ATX_CACHE_SECTORS - i;
+        }
+        u08 ok = faccess_read(currentFileOffset, (u08 *) &header, n * sizeof(struct atxSectorHeader)) != 0;
+        sectorHeader = header.sector;
+        for (j = 0; j < n; j++, sectorHeader++) {
+            struct atxCachedSector *s = &gTrackCache.sector[i + j];
+#ifndef __AVR__
+            byteSwapAtxSectorHeader(sectorHeader);
+#endif
+            s->number = sectorHeader->number;
+            // a header that could not be read is never found
+            s->status = ok ? sectorHeader->status : MASK_FDC_MISSING;
+            s->timev = sectorHeader->timev;
+        }
+        currentFileOffset += n * sizeof(struct atxSectorHeader);
+    }
+}
+
+// reads the header of a sector of the cached track from the file (0 if that fails)
+static u08 atxReadSectorHeader(u16 index, struct atxSectorHeader *header) {
+    if (!faccess_read(gTrackCache.list + index * sizeof(struct atxSectorHeader), (u08 *) header, sizeof(struct atxSectorHeader))) {
+        return 0;
+    }
+#ifndef __AVR__
+    byteSwapAtxSectorHeader(header);
+#endif
+    return 1;
+}
+
+// returns the header of a sector of the cached track, those above the cache size
+// are read from the file (0 if that fails)
+static struct atxCachedSector *atxGetSector(u16 index) {
+    static struct atxCachedSector uncached;
+    struct atxSectorHeader header;
+
+    if (index < ATX_CACHE_SECTORS) {
+        return &gTrackCache.sector[index];
+    }
+    if (!atxReadSectorHeader(index, &header)) {
+        return 0;
+    }
+    uncached.number = header.number;
+    uncached.status = header.status;
+    uncached.timev = header.timev;
+    return &uncached;
+}
+
+// returns the offset of the data of a sector of the cached track within the track,
+// 0 if it has none or its header can't be read
+static u16 atxSectorData(u16 index) {
+    struct atxSectorHeader header;
+
+    if (!atxReadSectorHeader(index, &header)) {
+        return 0;
+    }
+    return (u16) header.data;    // tracks are far below 64k
+}
+
+// finds a sector like the drive does and reads its data to atari_sector_buffer or
+// writes it from there (returns number of data bytes or 0 on error)
+static u16 atxAccessSector(u16 num, u08 *status, u08 write) {
+    struct atxCachedSector *sectorHeader;
 
     u16 i;
     u16 tgtSectorIndex = 0;         // the index of the target sector within the sector list
-    u32 tgtSectorOffset = 0;        // the offset of the target sector data
+    u16 tgtSectorOffset = 0;        // the offset of the target sector data
+    u08 tgtSectorStatus = 0;        // the status of the target sector in the file
     BOOL hasError = (BOOL) FALSE;   // flag for drive status errors
 
     // local variables used for weak data handling
     u08 extendedDataRecords = 0;
     int16_t weakOffset = -1;
 
-    // calculate track and relative sector number from the absolute sector number
-    u08 tgtTrackNumber = (num - 1) / gSectorsPerTrack + 1;
-    u08 tgtSectorNumber = (num - 1) % gSectorsPerTrack + 1;
+    // calculate track and relative sector number from the absolute sector number,
+    // the sector numbers of the head track are known
+    u08 tgtTrackNumber;
+    u08 tgtSectorNumber;
+    if (gTrackCache.track && (u16) (num - gTrackCache.first) < gSectorsPerTrack) {
+        tgtTrackNumber = gTrackCache.track;
+        tgtSectorNumber = num - gTrackCache.first + 1;
+    } else {
+        i = (num - 1) / gSectorsPerTrack + 1;
+        // there is no such track on a disk
+        if (i > MAX_TRACK) {
+            *status = ~MASK_FDC_MISSING;
+            return 0;
+        }
+        tgtTrackNumber = i;
+        tgtSectorNumber = (num - 1) % gSectorsPerTrack + 1;
+    }
 
     // set initial status (in case the target sector is not found)
-    *status = 0x10;
-    // set the sector size
-    *sectorSize = gBytesPerSector;
+    *status = MASK_FDC_MISSING;
+
+    // everything the drive does until the head is over the track is scheduled from the
+    // head position at the arrival of the request, so the SD card access in between
+    // (loading the sector list of a new track) does not add to the drive timing
+    u16 requestPosition = getCurrentHeadPosition();
+    u32 delay;
 
-    // delay for the time the drive takes to process the request
+    // the time the drive takes to process the request
     if (is_1050()) {
-        _delay_ms(MS_DRIVE_REQUEST_DELAY_1050);
+        delay = AU_MS(MS_DRIVE_REQUEST_DELAY_1050);
     } else {
-        _delay_ms(MS_DRIVE_REQUEST_DELAY_810);
+        delay = AU_MS(MS_DRIVE_REQUEST_DELAY_810);
     }
 
-    // delay for track stepping if needed
+    // track stepping and head settling if needed
     if (gCurrentHeadTrack != tgtTrackNumber) {
         signed char diff;
         diff = tgtTrackNumber - gCurrentHeadTrack;
         if (diff < 0) diff *= -1;
-        // wait for each track (this is done in a loop since _delay_ms needs a compile-time constant)
-        for (i = 0; i < diff; i++) {
-            if (is_1050()) {
-                _delay_ms(MS_TRACK_STEP_1050);
-            } else {
-                _delay_ms(MS_TRACK_STEP_810);
-            }
-        }
-        // delay for head settling
         if (is_1050()) {
-            _delay_ms(MS_HEAD_SETTLE_1050);
+            delay += diff * AU_MS(MS_TRACK_STEP_1050) + AU_MS(MS_HEAD_SETTLE_1050);
         } else {
-            _delay_ms(MS_HEAD_SETTLE_810);
+            delay += diff * AU_MS(MS_TRACK_STEP_810) + AU_MS(MS_HEAD_SETTLE_810);
         }
     }
 
     // set new head track position
     gCurrentHeadTrack = tgtTrackNumber;
 
-    // sample current head position
-    u16 headPosition = getCurrentHeadPosition();
-
-    // read the track header
-    u32 currentFileOffset = gTrackInfo[tgtTrackNumber - 1].offset;
-    // exit, if track not present
-    if (!currentFileOffset) {
-	goto error;
+    // load the sector list of a new track while the head steps
+    if (gTrackCache.track != tgtTrackNumber) {
+        atxCacheTrack(tgtTrackNumber);
     }
-    faccess_offset(FILE_ACCESS_READ, currentFileOffset, sizeof(struct atxTrackHeader));
-    trackHeader = (struct atxTrackHeader *) atari_sector_buffer;
-#ifndef __AVR__
-    byteSwapAtxTrackHeader(trackHeader);
-#endif
-    u16 sectorCount = trackHeader->sectorCount;
 
-    // if there are no sectors in this track or the track number doesn't match, return error
-    if (trackHeader->trackNumber == tgtTrackNumber - 1 && sectorCount) {
-        // read the sector list header if there are sectors for this track
-	currentFileOffset += trackHeader->headerSize;
-	faccess_offset(FILE_ACCESS_READ, currentFileOffset, sizeof(struct atxSectorListHeader));
-	slHeader = (struct atxSectorListHeader *) atari_sector_buffer;
-#ifndef __AVR__
-	byteSwapAtxSectorListHeader(slHeader);
-#endif
+    waitForAngularDelay(requestPosition, delay);
 
-	// sector list header is variable length, so skip any extra header bytes that may be present
-	currentFileOffset += slHeader->next - sectorCount * sizeof(struct atxSectorHeader);
+    // sample current head position
+    u16 headPosition = getCurrentHeadPosition();
 
+    u16 sectorCount = gTrackCache.count;
+
+    // if there are no sectors in this track or the track is not present, return error
+    if (sectorCount) {
         int pTT = 0;
         int retries = MAX_RETRIES_810;
 
         // if we are still below the maximum number of retries that would be performed by the drive firmware...
-        u32 retryOffset = currentFileOffset;
         while (retries > 0) {
             retries--;
-            currentFileOffset = retryOffset;
             // iterate through all sector headers to find the target sector
             for (i=0; i < sectorCount; i++) {
-                if (faccess_offset(FILE_ACCESS_READ, currentFileOffset, sizeof(struct atxSectorHeader))) {
-                    sectorHeader = (struct atxSectorHeader *) atari_sector_buffer;
-#ifndef __AVR__
-                    byteSwapAtxSectorHeader(sectorHeader);
-#endif
+                if ((sectorHeader = atxGetSector(i))) {
                     // if the sector is not flagged as missing and its number matches the one we're looking for...
                     if (!(sectorHeader->status & MASK_FDC_MISSING) && sectorHeader->number == tgtSectorNumber) {
                         // check if it's the next sector that the head would encounter angularly...
@@ -218,7 +409,7 @@ u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status) {
                         if (pTT == 0 || (tt > 0 && pTT < 0) || (tt > 0 && pTT > 0 && tt < pTT) || (tt < 0 && pTT < 0 && tt < pTT)) {
                             pTT = tt;
                             gLastAngle = sectorHeader->timev;
-                            *status = sectorHeader->status;
+                            *status = tgtSectorStatus = sectorHeader->status;
                             // On an Atari 810, we have to do some specific behavior 
                             // when a long sector is encountered (the lost data bit 
                             // is set):
@@ -237,55 +428,77 @@ u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status) {
                                 extendedDataRecords++;
                             }
                             tgtSectorIndex = i;
-                            tgtSectorOffset = sectorHeader->data;
                         }
                     }
-                    currentFileOffset += sizeof(struct atxSectorHeader);
                 }
             }
-            // if the sector status is bad, delay for a full disk rotation
-            if (*status) {
-                waitForAngularPosition(incAngularDisplacement(getCurrentHeadPosition(), AU_FULL_ROTATION));
+            // if the sector status is bad, delay for a full disk rotation (a write
+            // only needs to find the sector, its data field is written anew)
+            if (write ? (*status & MASK_FDC_MISSING) : *status) {
+                waitForAngularDelay(getCurrentHeadPosition(), AU_FULL_ROTATION);
+                // the seek to the sector starts over from here
+                headPosition = getCurrentHeadPosition();
             // otherwise, no need to retry
             } else {
                 retries = 0;
             }
         }
 
+        // the data offset is not cached, only the one of the sector found is read
+        if (!(*status & MASK_FDC_MISSING)) {
+            tgtSectorOffset = atxSectorData(tgtSectorIndex);
+        }
+
         // store the last angle returned for the debugging window
         last_angle_returned = gLastAngle;
 
+        if (write) {
+            // a sector that is not found can't be written
+            if (*status & MASK_FDC_MISSING) {
+                hasError = (BOOL) TRUE;
+            } else {
+                *status = 0;
+            }
         // if the status is bad, flag as error
-        if (*status) {
+        } else if (*status) {
             hasError = (BOOL) TRUE;
         }
 
-        // if an extended data record exists for this track, iterate through all track chunks to search
-        // for those records (note that we stop looking for chunks when we hit the 8-byte terminator; length == 0)
-        if (extendedDataRecords > 0) {
-            currentFileOffset = gTrackInfo[tgtTrackNumber - 1].offset + trackHeader->headerSize;
-            do {
-                faccess_offset(FILE_ACCESS_READ, currentFileOffset, sizeof(struct atxTrackChunk));
-                extSectorData = (struct atxTrackChunk *) atari_sector_buffer;
-#ifndef __AVR__
-                byteSwapAtxTrackChunk(extSectorData);
-#endif
-                if (extSectorData->size > 0) {
-                    // if the target sector has a weak data flag, grab the start weak offset within the sector data
-                    if (extSectorData->sectorIndex == tgtSectorIndex && extSectorData->type == 0x10) {
-                        weakOffset = extSectorData->data;
+        if (write) {
+            if (!hasError && tgtSectorOffset) {
+                // write the data in place, the track layout stays as it is
+                i = (u16) faccess_offset(FILE_ACCESS_WRITE, gTrackCache.offset + tgtSectorOffset, gBytesPerSector);
+                if (i) {
+                    // the new data field has a good CRC and no weak bits any more
+                    u08 newStatus = tgtSectorStatus & ~MASK_FDC_CRC;
+                    if ((tgtSectorStatus & MASK_EXTENDED_DATA) && atxScanChunks((u08) tgtSectorIndex, 1) > -1) {
+                        newStatus &= ~MASK_EXTENDED_DATA;
+                    }
+                    if (newStatus != tgtSectorStatus) {
+                        faccess_write(gTrackCache.list + tgtSectorIndex * sizeof(struct atxSectorHeader)
+                                      + offsetof(struct atxSectorHeader, status), &newStatus, 1);
+                        if (tgtSectorIndex < ATX_CACHE_SECTORS) {
+                            gTrackCache.sector[tgtSectorIndex].status = newStatus;
+                        }
                     }
-                    currentFileOffset += extSectorData->size;
                 }
-            } while (extSectorData->size > 0);
-        }
+                tgtSectorIndex = i;
+            } else {
+                tgtSectorIndex = 0;
+            }
+        } else {
+            // if an extended data record exists for this track, take the weak data offset of the target sector
+            if (extendedDataRecords > 0) {
+                weakOffset = atxScanChunks((u08) tgtSectorIndex, 0);
+            }
 
-        // read the data (re-using tgtSectorIndex variable here to reduce stack consumption)
-        if (tgtSectorOffset) {
-            tgtSectorIndex = (u16) faccess_offset(FILE_ACCESS_READ, gTrackInfo[tgtTrackNumber - 1].offset + tgtSectorOffset, gBytesPerSector);
-        }
-        if (hasError) {
-            tgtSectorIndex = 0;
+            // read the data (re-using tgtSectorIndex variable here to reduce stack consumption)
+            if (tgtSectorOffset) {
+                tgtSectorIndex = (u16) faccess_offset(FILE_ACCESS_READ, gTrackCache.offset + tgtSectorOffset, gBytesPerSector);
+            }
+            if (hasError) {
+                tgtSectorIndex = 0;
+            }
         }
 
         // if a weak offset is defined, randomize the appropriate data
@@ -303,27 +516,46 @@ u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status) {
             rotationDelay = (AU_FULL_ROTATION - headPosition + gLastAngle);
         }
 
-        // determine the angular position we need to wait for by summing the head position, rotational delay and the number 
-        // of rotational units for a sector read. Then wait for the head to reach that position.
-        // (Concern: can the SD card read take more time than the amount the disk would have rotated?)
-        waitForAngularPosition(incAngularDisplacement(incAngularDisplacement(headPosition, rotationDelay), AU_ONE_SECTOR_READ));
+        // wait for the head to pass the sector: rotational delay of the sector seek plus the
+        // angular units for a sector read from the sampled head position, the SD card read of
+        // the data above is part of that time
+        waitForAngularDelay(headPosition, (u32) rotationDelay + AU_ONE_SECTOR_READ);
+
+        // self-calibration for the debug window: how far the head went past the wanted position
+        u16 target = incAngularDisplacement(incAngularDisplacement(headPosition, rotationDelay), AU_ONE_SECTOR_READ);
+        int16_t deviation = getCurrentHeadPosition() - target;
+        if (deviation > AU_FULL_ROTATION / 2) {
+            deviation -= AU_FULL_ROTATION;
+        } else if (deviation < -AU_FULL_ROTATION / 2) {
+            deviation += AU_FULL_ROTATION;
+        }
+        last_angle_deviation = deviation;
 
         // delay for CRC calculation
         if (is_1050()) {
-            _delay_ms(MS_CRC_CALCULATION_1050);
+            waitForAngularDelay(target, AU_MS(MS_CRC_CALCULATION_1050));
         } else {
-            _delay_ms(MS_CRC_CALCULATION_810);
+            waitForAngularDelay(target, AU_MS(MS_CRC_CALCULATION_810));
         }
     }
 
-error:
     // the Atari expects an inverted FDC status byte
     *status = ~(*status);
 
-    // return the number of bytes read
+    // return the number of bytes read or written
     return tgtSectorIndex;
 }
 
+u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status) {
+    // set the sector size
+    *sectorSize = gBytesPerSector;
+    return atxAccessSector(num, status, 0);
+}
+
+u16 saveAtxSector(u16 num, u08 *status) {
+    return atxAccessSector(num, status, 1);
+}
+
 u16 incAngularDisplacement(u16 start, u16 delta) {
     // increment an angular position by a delta taking a full rotation into consideration
     u16 ret = start + delta;
@@ -25,6 +25,16 @@
 #define ATX_VERSION		0x01
 #define STS_EXTENDED	0x40
 #define MAX_TRACK	42
+// number of angular units in a full disk rotation
+#define AU_FULL_ROTATION	26042
+
+// sector headers of the actual head track kept in RAM (4 bytes each, the
+// data offset of the sector found is read from the file), sectors above
+// this count of a track are read from the file as before: one SD or DD
+// track, an ED track reads its last 8 headers
+#ifndef ATX_CACHE_SECTORS
+#define ATX_CACHE_SECTORS	18
+#endif
 
 struct atxFileHeader {
     u08 signature[4];
@@ -71,6 +81,12 @@ struct atxSectorHeader {
     u32 data;
 };
 
+struct atxCachedSector {
+    u08 number;
+    u08 status;
+    u16 timev;
+};
+
 struct atxTrackChunk {
     u32 size;
     u08 type;
@@ -87,6 +103,10 @@ u16 loadAtxFile();
 // load data for a specific disk sector (returns number of data bytes read or 0 if sector not found)
 u16 loadAtxSector(u16 num, unsigned short *sectorSize, u08 *status);
 
+// write data from atari_sector_buffer to a specific disk sector in place (returns number of
+// data bytes written or 0 if sector not found)
+u16 saveAtxSector(u16 num, u08 *status);
+
 // returns the current head position in angular units
 u16 getCurrentHeadPosition();
 
@@ -96,6 +116,11 @@ u16 incAngularDisplacement(u16 start, u16 delta);
 // delays until head position reaches the specified position
 void waitForAngularPosition(u16 pos);
 
+// delays until the head has moved the specified angular units since it was at start
+// (the time already spent since then counts and must be less than a rotation,
+// the delay may be longer)
+void waitForAngularDelay(u16 start, u32 delay);
+
 // hook to allow platform-specific implementations to change byte ordering as needed
 void byteSwapAtxFileHeader(struct atxFileHeader * header);
 
@@ -40,6 +40,18 @@ void waitForAngularPosition(u16 pos) {
     while (TCNT1 / 2 < pos);
 }
 
+void waitForAngularDelay(u16 start, u32 delay) {
+    u16 pos, last = start;
+    u32 elapsed = 0;
+
+    // sum up the way of the head since start, the timer rolls over once per rotation
+    while (elapsed < delay) {
+        pos = TCNT1 / 2;
+        elapsed += (pos >= last) ? pos - last : AU_FULL_ROTATION + 1 - last + pos;
+        last = pos;
+    }
+}
+
 u16 getCurrentHeadPosition() {
     // TCNT1 is a variable driven by an Atmel timer that ticks every 4 microseconds. A full 
     // rotation of the disk is represented in an ATX file by an angular positional value 
@@ -0,0 +1,665 @@
+// Sorted name index of the actual directory: the prefix search ($C3, the
+// letter strip of the file page) and the sorted view of the file page and
+// of the listing commands (file index | DIRINDEX_SORTED).
+//
+// SDRIVE.IDX: sector 0 is the header, behind it two regions of 16 byte
+// records, one per directory entry: class (0 directory, 1 file), the 8+3
+// name, the entry number and the first two chars of the long name.  One
+// region holds the records sorted by class and name, the other one is the
+// scratch of the sort.
+//
+// The index is built in the main loop (dirIndexStep), a directory sector or
+// a few records at a time, never inside a command; a step changes one
+// sector of SDRIVE.IDX at most, the caller writes it back before the next
+// one.  Until it is done the sorted view is the directory order.  A
+// directory the header claims is scanned first: same number of entries,
+// last cluster and hash of the names and the index is taken as it is; with
+// only a few entries added behind the indexed ones (in one sector of
+// records), they are sorted and merged in.  Else the records
+// are written in one pass over the directory, sorted per sector and merge
+// sorted between the two regions.  Nothing is kept in atari_sector_buffer
+// from one step to the next.
+
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "avrlibdefs.h"         // global AVRLIB defines
+#include "avrlibtypes.h"        // global AVRLIB types definitions
+#include "fat.h"
+#include "mmc.h"
+#include "dirindex.h"
+
+extern unsigned char atari_sector_buffer[256];
+extern struct GlobalSystemValues GS;
+extern struct FileInfoStruct FileInfo;
+extern u32 dir_end_cluster;
+extern unsigned char dir_writes;
+unsigned char sio_yield();
+
+#define TWOBYTESTOWORD(ptr)	*((u16*)(ptr))
+
+#define DIX_RECORD	16
+#define DIX_PER_SECTOR	(512/DIX_RECORD)
+#define DIX_KEY		12	// class + 8.3 name, the sort key
+#define DIX_ENTRY	12	// entry number (u16)
+#define DIX_LKEY	14	// first 2 chars of the long name, 0 = none
+#define DIX_TAIL	8	// added entries merged in without a full sort
+#define DIX_MAX_REGION	(DIRINDEX_SORTED/DIX_PER_SECTOR-1)
+
+struct dix_header {
+	char magic[4];			// "SDIX"
+	u32 dir;			// dir_cluster of the indexed directory
+	unsigned short entries;		// its entries
+	u32 last;			// and last cluster
+	unsigned short hash;		// of the names of the entries
+	unsigned short dirs;		// directories, sorted in front of the files
+	unsigned char region;		// the one with the sorted records
+};
+
+u32 dix_first;			// first sector of SDRIVE.IDX
+unsigned short dix_regsize;	// sectors per region, 0 = no index
+struct dix_header dix;
+unsigned char dix_valid;	// dix is checked against the directory,
+unsigned char dix_writes;	// since dir_writes had this value
+
+// steps of the build
+#define DIX_IDLE	0
+#define DIX_START	1	// the directory is wanted
+#define DIX_SCAN	2	// a directory sector, its records written
+#define DIX_ISORT	3	// a sector of records sorted on its own
+#define DIX_MERGE	4	// runs of w records merged by twos, 4-8 records
+#define DIX_DONE	5	// the header
+#define DIX_FLUSH	6	// the header written back, the index is ready
+
+struct {
+	unsigned char state;
+	unsigned char writes;		// dir_writes at the start
+	unsigned char region;		// the records are in
+	unsigned char lkey[2];		// long name of the next entry
+	u32 dir;
+	u32 last;			// last cluster of the directory
+	unsigned short count;		// its entries
+	unsigned short from;		// first entry with a record, 0 = full build
+	unsigned short n;		// records to sort
+	unsigned short hash;		// of the names scanned so far
+	unsigned short front;		// of the names in front of from
+	unsigned short dirs;		// directories among the records
+	unsigned short base;		// first entry of the directory sector
+	union {
+		dir_scan_t scan;
+		struct {
+			unsigned short w;	// run width (ISORT: next record)
+			unsigned short start;	// pair of runs (ISORT: first width)
+			unsigned short a, b;	// next record of each run
+			unsigned short out;	// next output record
+		} m;
+	} u;
+} dix_job;
+
+unsigned char dix_key[11];	// prefix in the 8+3 form (NAME    EXT)
+unsigned char dix_keylen;	// its length, >11 if no 8+3 name can match
+unsigned char dix_keydot;	// the prefix ends with the dot
+
+static u32 dix_sector(u08 region, unsigned short rec)
+{
+	return dix_first + 1 + (region ? dix_regsize : 0) + rec / DIX_PER_SECTOR;
+}
+
+static unsigned char *dix_record(u08 region, unsigned short rec)
+{
+	mmcReadCached(dix_sector(region, rec));
+	return mmc_sector_buffer + (rec % DIX_PER_SECTOR) * DIX_RECORD;
+}
+
+// n records from rec on to buf (or from buf with write set), one or two sectors
+static void dix_copy(u08 region, unsigned short rec, unsigned char *buf, u08 n, u08 write)
+{
+	u08 k;
+
+	while (n)
+	{
+		k = DIX_PER_SECTOR - rec % DIX_PER_SECTOR;
+		if (k > n) k = n;
+		if (write)
+		{
+			memcpy(dix_record(region, rec), buf, k * DIX_RECORD);
+			mmcWriteCached(0);
+		}
+		else
+			memcpy(buf, dix_record(region, rec), k * DIX_RECORD);
+		buf += k * DIX_RECORD;
+		rec += k;
+		n -= k;
+	}
+}
+
+static void dix_header_write(void)
+{
+	mmcReadCached(dix_first);
+	memcpy(mmc_sector_buffer, &dix, sizeof(dix));
+	mmcWriteCached(0);
+}
+
+// looks for SDRIVE.IDX in the actual (root) dir, 0 if there is none
+u08 dirIndexInit(void)
+{
+	unsigned short i, sectors = 0, max;
+	u32 c, next;
+
+	dix_regsize = 0;
+	dix_valid = 0;
+	dix_job.state = DIX_IDLE;
+	dix.dir = CLUST_EOFE;
+
+	for (i = 0; fatGetDirEntry(i,0); i++)
+	{
+		if (memcmp_P(atari_sector_buffer, PSTR("SDRIVE  IDX"), 11) || (FileInfo.Attr & ATTR_DIRECTORY))
+			continue;
+		max = 1 + 2 * DIX_MAX_REGION;
+		if ((FileInfo.vDisk->size >> 9) < max) max = FileInfo.vDisk->size >> 9;
+		if (max < 3) break;
+		c = FileInfo.vDisk->start_cluster;
+		dix_first = fatClustToSect(c);
+		//only the first run of clusters, the rest is not used
+		do {
+			sectors += SectorsPerCluster;
+			if (sectors >= max) break;
+			next = fatNextCluster(c);
+		} while (next == ++c);
+		if (sectors > max) sectors = max;
+		dix_regsize = (sectors - 1) / 2;
+		if (!dix_regsize) break;
+		mmcReadCached(dix_first);
+		if (!memcmp_P(mmc_sector_buffer, PSTR("SDIX"), 4))
+			memcpy(&dix, mmc_sector_buffer, sizeof(dix));
+		break;
+	}
+	return dix_regsize != 0;
+}
+
+// the index is the one of the actual directory as it is
+static u08 dix_ready(void)
+{
+	return dix_regsize && dix_valid && dix_writes == dir_writes
+		&& dix.dir == FileInfo.vDisk->dir_cluster;
+}
+
+// records of the actual directory in the index (the first entries)
+static unsigned short dix_indexed(void)
+{
+	if (!dix_ready()) return 0;
+	if (dix.entries > dix_regsize * DIX_PER_SECTOR) return dix_regsize * DIX_PER_SECTOR;
+	return dix.entries;
+}
+
+// entries from dix_job.from up to this one get a record
+static unsigned short dix_limit(void)
+{
+	unsigned short cap = dix_regsize * DIX_PER_SECTOR;
+
+	if (dix_job.from && dix_job.from < cap && cap - dix_job.from > DIX_TAIL) return dix_job.from + DIX_TAIL;
+	return cap;
+}
+
+// record of entry to atari_sector_buffer, at its place in the actual directory sector
+static void dix_put(struct direntry *de, unsigned short entry)
+{
+	unsigned char *r;
+	u08 i;
+	unsigned char c;
+
+	if (de->deAttributes == ATTR_LONG_FILENAME)
+	{
+		struct winentry *we = (struct winentry *) de;
+		//first part of the long name, the short entry follows
+		if ((we->weCnt & WIN_CNT) == 1)
+		{
+			for (i = 0; i < 2; i++)
+			{
+				c = we->wePart1[i*2];
+				if (c >= 'a' && c <= 'z') c -= 'a'-'A';
+				dix_job.lkey[i] = c;
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < 11; i++) dix_job.hash = ((dix_job.hash << 3) | (dix_job.hash >> 13)) + de->deName[i];
+	dix_job.hash += de->deAttributes & ATTR_DIRECTORY;
+	if (entry + 1 == dix_job.from) dix_job.front = dix_job.hash;
+
+	if (entry >= dix_job.from && entry < dix_limit())
+	{
+		r = atari_sector_buffer + (entry - dix_job.base) * DIX_RECORD;
+		r[0] = (de->deAttributes & ATTR_DIRECTORY) ? 0 : 1;
+		if (!r[0]) dix_job.dirs++;
+		memcpy(r + 1, de->deName, 11);
+		TWOBYTESTOWORD(r + DIX_ENTRY) = entry;
+		r[DIX_LKEY] = dix_job.lkey[0];
+		r[DIX_LKEY+1] = dix_job.lkey[1];
+	}
+	//no long name for the next one yet
+	dix_job.lkey[0] = dix_job.lkey[1] = 0;
+}
+
+static void dix_isort(unsigned char *p, u08 n)
+{
+	unsigned char t[DIX_RECORD];
+	unsigned char *a;
+	u08 i, j;
+
+	for (i = 1; i < n; i++)
+		for (j = i; j; j--)
+		{
+			a = p + (j - 1) * DIX_RECORD;
+			if (memcmp(a, a + DIX_RECORD, DIX_KEY) <= 0) break;
+			memcpy(t, a, DIX_RECORD);
+			memcpy(a, a + DIX_RECORD, DIX_RECORD);
+			memcpy(a + DIX_RECORD, t, DIX_RECORD);
+		}
+}
+
+// up to 4 records of a run (within one sector) to buf
+static u08 dix_run_fill(unsigned char *buf, unsigned short pos, unsigned short end)
+{
+	u08 n = DIX_PER_SECTOR - pos % DIX_PER_SECTOR;
+
+	if (n > 4) n = 4;
+	if (n > end - pos) n = end - pos;
+	if (n) dix_copy(dix_job.region, pos, buf, n, 0);
+	return n;
+}
+
+// merge passes from w on over the n records of dix_job.region
+static void dix_merge_start(unsigned short w)
+{
+	dix_job.u.m.w = w;
+	dix_job.u.m.start = 0;
+	dix_job.u.m.a = 0;
+	dix_job.u.m.b = (dix_job.n > w) ? w : dix_job.n;
+	dix_job.u.m.out = 0;
+	dix_job.state = (w < dix_job.n) ? DIX_MERGE : DIX_DONE;
+}
+
+// a step of a merge pass: runs of w records of region dix_job.region by twos
+// into the other one, 4 records of each run and 8 of the output buffered,
+// the output up to the end of its sector (one sector to write back)
+static void dix_merge(void)
+{
+	unsigned char *a = atari_sector_buffer + 128, *b = atari_sector_buffer + 192;
+	unsigned short n = dix_job.n, w = dix_job.u.m.w, start = dix_job.u.m.start;
+	unsigned short aend = (n - start > w) ? start + w : n;
+	unsigned short bend = (n - aend > w) ? aend + w : n;
+	u08 na, nb, ia = 0, ib = 0, o = 0;
+	u08 omax = DIX_PER_SECTOR - dix_job.u.m.out % DIX_PER_SECTOR;
+
+	if (omax > 8) omax = 8;
+	na = dix_run_fill(a, dix_job.u.m.a, aend);
+	nb = dix_run_fill(b, dix_job.u.m.b, bend);
+	//the output until one buffer is empty with records of its run still to come
+	while (o < omax && (ia < na || dix_job.u.m.a + ia == aend) && (ib < nb || dix_job.u.m.b + ib == bend)
+		&& (ia < na || ib < nb))
+	{
+		if (ib == nb || (ia < na && memcmp(a + ia * DIX_RECORD, b + ib * DIX_RECORD, DIX_KEY) < 0))
+			memcpy(atari_sector_buffer + o++ * DIX_RECORD, a + ia++ * DIX_RECORD, DIX_RECORD);
+		else
+			memcpy(atari_sector_buffer + o++ * DIX_RECORD, b + ib++ * DIX_RECORD, DIX_RECORD);
+	}
+	dix_copy(dix_job.region ^ 1, dix_job.u.m.out, atari_sector_buffer, o, 1);
+	dix_job.u.m.out += o;
+	dix_job.u.m.a += ia;
+	dix_job.u.m.b += ib;
+
+	if (dix_job.u.m.a == aend && dix_job.u.m.b == bend)
+	{
+		start += 2 * w;
+		if (start >= n)
+		{
+			//pass done, the next one with runs twice as long
+			dix_job.region ^= 1;
+			dix_merge_start(2 * w);
+			return;
+		}
+		dix_job.u.m.start = start;
+		dix_job.u.m.a = start;
+		dix_job.u.m.b = (n - start > w) ? start + w : n;
+	}
+}
+
+// the scan of the whole directory, records of all of it into the scratch region
+static void dix_full(void)
+{
+	dix_job.from = 0;
+	dix_job.region = (dix.region ^ 1) & 1;
+	dix_valid = 0;
+	dix.magic[0] = 0;		//invalid until it is done
+	dix_header_write();
+	dix_job.hash = 0;
+	dix_job.dirs = 0;
+	dix_job.lkey[0] = dix_job.lkey[1] = 0;
+	fatScanDirStart(&dix_job.u.scan, dix_job.dir, 0);
+	dix_job.state = DIX_SCAN;
+}
+
+// the directory and the header seen, what is to be done
+static void dix_scanned(void)
+{
+	unsigned short cap = dix_regsize * DIX_PER_SECTOR;
+	unsigned short old;
+
+	dix_job.n = (dix_job.count > cap) ? cap : dix_job.count;
+	if (!dix_job.from)
+	{
+		dix_job.u.m.w = 0;
+		dix_job.u.m.start = DIX_PER_SECTOR;
+		dix_job.state = DIX_ISORT;
+		return;
+	}
+	//the index as it is
+	if (dix_job.count == dix.entries && dix_job.last == dix.last && dix_job.hash == dix.hash)
+	{
+		dix_valid = 1;
+		dix_writes = dix_job.writes;
+		dix_job.state = DIX_IDLE;
+		return;
+	}
+	//only a few added and the ones in front did not change: sorted in
+	//their sector and merged in (across two sectors the full build)
+	old = (dix.entries > cap) ? cap : dix.entries;
+	if (dix_job.count > dix.entries && dix_job.count - dix.entries <= DIX_TAIL
+		&& dix_job.front == dix.hash && dix_job.n - old <= old
+		&& old % DIX_PER_SECTOR + (dix_job.n - old) <= DIX_PER_SECTOR)
+	{
+		dix_job.u.m.w = old;
+		dix_job.u.m.start = old;
+		dix_job.state = DIX_ISORT;
+		return;
+	}
+	//the header is written in a step of its own
+	dix.magic[0] = 0;
+	dix_job.state = DIX_START;
+}
+
+// one step of the index build; returns 1 when the index of a directory got ready
+u08 dirIndexStep(void)
+{
+	unsigned short s;
+
+	switch (dix_job.state)
+	{
+	case DIX_START:
+		dix_job.writes = dir_writes;
+		//the index the header claims is checked, new entries get their records
+		if (dix.dir == dix_job.dir && dix.entries && dix.magic[0] == 'S')
+		{
+			dix_job.from = dix.entries;
+			dix_job.region = dix.region & 1;
+			dix_job.hash = 0;
+			dix_job.dirs = 0;
+			dix_job.lkey[0] = dix_job.lkey[1] = 0;
+			fatScanDirStart(&dix_job.u.scan, dix_job.dir, 0);
+			dix_job.state = DIX_SCAN;
+		}
+		else
+			dix_full();
+		break;
+
+	case DIX_SCAN:
+		{
+			unsigned short e, lim = dix_limit();
+			u08 more;
+
+			dix_job.base = dix_job.u.scan.entries;
+			more = fatScanDirSector(&dix_job.u.scan, dix_put);
+			//the records of the entries of this sector
+			e = dix_job.u.scan.entries;
+			s = dix_job.base;
+			if (s < dix_job.from) s = dix_job.from;
+			if (e > lim) e = lim;
+			if (e > s)
+				dix_copy(dix_job.region, s, atari_sector_buffer + (s - dix_job.base) * DIX_RECORD, e - s, 1);
+			if (more) break;
+		}
+		dix_job.count = dix_job.u.scan.entries;
+		dix_job.last = dir_end_cluster;
+		dix_scanned();
+		break;
+
+	case DIX_ISORT:
+		s = dix_job.u.m.w;
+		if (s < dix_job.n)
+		{
+			u08 k = DIX_PER_SECTOR - s % DIX_PER_SECTOR;
+
+			if (k > dix_job.n - s) k = dix_job.n - s;
+			dix_isort(dix_record(dix_job.region, s), k);
+			mmcWriteCached(0);
+			dix_job.u.m.w += k;
+			break;
+		}
+		//merge passes from the width the records are sorted in
+		dix_merge_start(dix_job.u.m.start);
+		break;
+
+	case DIX_MERGE:
+		dix_merge();
+		break;
+
+	case DIX_DONE:
+		if (dix_job.writes != dir_writes)
+		{
+			//a file was created meanwhile
+			dix_job.state = DIX_START;
+			break;
+		}
+		if (dix_job.from)
+			dix.dirs += dix_job.dirs;
+		else
+			dix.dirs = dix_job.dirs;
+		dix.region = dix_job.region;
+		dix.dir = dix_job.dir;
+		dix.entries = dix_job.count;
+		dix.last = dix_job.last;
+		dix.hash = dix_job.hash;
+		memcpy_P(dix.magic, PSTR("SDIX"), 4);
+		dix_header_write();
+		dix_job.state = DIX_FLUSH;
+		break;
+
+	case DIX_FLUSH:
+		mmcWriteCachedFlush();
+		dix_valid = 1;
+		dix_writes = dix_job.writes;
+		dix_job.state = DIX_IDLE;
+		return 1;
+	}
+	return 0;
+}
+
+// a build is waiting for dirIndexStep()
+u08 dirIndexBusy(void)
+{
+	return dix_job.state;
+}
+
+// 1 if the index holds the actual directory; else its build is started
+// (dirIndexStep) and the sorted view is the directory order until then
+u08 dirIndexUpdate(void)
+{
+	if (!dix_regsize) return 0;
+	if (dix_ready()) return 1;
+	if (dix_job.state == DIX_IDLE || dix_job.dir != FileInfo.vDisk->dir_cluster)
+	{
+		dix_job.dir = FileInfo.vDisk->dir_cluster;
+		dix_job.state = DIX_START;
+	}
+	return 0;
+}
+
+// entry at position pos of the sorted view (pos | DIRINDEX_SORTED), the
+// ones behind the index in directory order; without the flag entry pos
+unsigned short dirIndexEntry(unsigned short pos)
+{
+	if (!(pos & DIRINDEX_SORTED)) return pos;
+	pos &= ~DIRINDEX_SORTED;
+	if (pos >= dix_indexed()) return pos;
+	return TWOBYTESTOWORD(dix_record(dix.region, pos) + DIX_ENTRY);
+}
+
+// prefix (upper case) in the 8+3 form
+static void dix_rawkey(char *prefix)
+{
+	u08 i, j = 0;
+	unsigned char c;
+
+	dix_keydot = 0;
+	for (i = 0; i < 11 && (c = prefix[i]); i++)
+	{
+		if (c == '.' && j && dix_key[0] != '.' && !dix_keydot)
+		{
+			if (j > 8) goto dix_nomatch;
+			while (j < 8) dix_key[j++] = ' ';
+			dix_keydot = 1;
+			continue;
+		}
+		if (j == (dix_keydot ? 11 : 8)) goto dix_nomatch;
+		dix_key[j++] = c;
+	}
+	dix_keylen = j;
+	dix_keydot = dix_keydot && j == 8;	//NAME. needs an extension
+	return;
+dix_nomatch:
+	dix_keylen = 0xFF;
+}
+
+static u08 dix_match83(unsigned char *r)
+{
+	if (dix_keylen > 11 || memcmp(r + 1, dix_key, dix_keylen)) return 0;
+	return !dix_keydot || r[9] != ' ';
+}
+
+static u08 dix_prefix(char *prefix, u08 len, unsigned char *name, u08 n)
+{
+	u08 i;
+	unsigned char c;
+
+	for (i = 0; i < len; i++)
+	{
+		if (i == n) return 1;		//all the key has
+		c = name[i];
+		if (c >= 'a' && c <= 'z') c -= 'a'-'A';
+		if (c != prefix[i]) return 0;
+	}
+	return 1;
+}
+
+// entry matches by its long name or NAME.EXT; leaves it in FileInfo and
+// its 8.3 name in atari_sector_buffer like fatGetDirEntry(entry,0)
+static u08 dix_match(char *prefix, u08 len, unsigned short entry)
+{
+	unsigned char *f = atari_sector_buffer + 16;
+	u08 i, j;
+
+	if (fatGetDirEntry(entry,1) && dix_prefix(prefix, len, atari_sector_buffer, 0xFF))
+		return fatGetDirEntry(entry,0);
+	if (!fatGetDirEntry(entry,0)) return 0;
+	for (i = 0, j = 0; i < 8 && atari_sector_buffer[i] != ' '; ) f[j++] = atari_sector_buffer[i++];
+	if (atari_sector_buffer[8] != ' ')
+	{
+		f[j++] = '.';
+		for (i = 8; i < 11 && atari_sector_buffer[i] != ' '; ) f[j++] = atari_sector_buffer[i++];
+	}
+	f[j] = 0;
+	return dix_prefix(prefix, len, f, 0xFF);
+}
+
+static u08 dix_upper(char *prefix)
+{
+	u08 len;
+
+	for (len = 0; len < 11 && prefix[len]; len++)
+		if (prefix[len] >= 'a' && prefix[len] <= 'z') prefix[len] -= 'a'-'A';
+	dix_rawkey(prefix);
+	return len;
+}
+
+// first entry from 'from' on whose long name or NAME.EXT starts with prefix
+// (up to 11 chars, any case, turned upper case in place), DIRINDEX_NOTFOUND
+// if there is none
+unsigned short dirIndexFind(char *prefix, unsigned short from)
+{
+	unsigned short i, e, n = 0, best = DIRINDEX_NOTFOUND;
+	unsigned char *r;
+	u08 len = dix_upper(prefix);
+
+	if (dirIndexUpdate())
+	{
+		n = dix_indexed();
+		//8.3 names are in the records
+		for (i = 0; i < n; i++)
+		{
+			//a command may come in between the sectors, it may change the index
+			if (!(i % DIX_PER_SECTOR) && sio_yield() && !dix_ready()) goto dix_scan;
+			r = dix_record(dix.region, i);
+			e = TWOBYTESTOWORD(r + DIX_ENTRY);
+			if (e >= from && e < best && dix_match83(r)) best = e;
+		}
+		//long names in front of it
+		for (i = 0; i < n; i++)
+		{
+			if (!(i % DIX_PER_SECTOR) && sio_yield() && !dix_ready()) goto dix_scan;
+			r = dix_record(dix.region, i);
+			e = TWOBYTESTOWORD(r + DIX_ENTRY);
+			if (e >= from && e < best && r[DIX_LKEY]
+				&& dix_prefix(prefix, len, r + DIX_LKEY, 2) && dix_match(prefix, len, e))
+				best = e;
+		}
+		if (best != DIRINDEX_NOTFOUND)
+		{
+			fatGetDirEntry(best,0);
+			return best;
+		}
+	}
+
+	if (0)
+	{
+dix_scan:
+		n = 0;
+	}
+	//not in the index
+	for (e = (from > n) ? from : n; fatGetDirEntry(e,0); e++)
+	{
+		if (dix_match(prefix, len, e)) return e;
+		sio_yield();
+	}
+
+	return DIRINDEX_NOTFOUND;
+}
+
+// first position of the sorted view whose 8.3 name starts with prefix,
+// DIRINDEX_NOTFOUND if there is none or no index
+unsigned short dirIndexLocate(char *prefix)
+{
+	unsigned short lo, hi, end, mid;
+	u08 c;
+
+	dix_upper(prefix);
+	if (!dirIndexUpdate() || dix_keylen > 11) return DIRINDEX_NOTFOUND;
+
+	//directories, then files
+	for (c = 0; c < 2; c++)
+	{
+		lo = c ? dix.dirs : 0;
+		end = hi = c ? dix_indexed() : dix.dirs;
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			if (memcmp(dix_record(dix.region, mid) + 1, dix_key, dix_keylen) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < end && !memcmp(dix_record(dix.region, lo) + 1, dix_key, dix_keylen); lo++)
+			if (dix_match83(dix_record(dix.region, lo))) return lo;
+	}
+	return DIRINDEX_NOTFOUND;
+}
@@ -0,0 +1,16 @@
+// Sorted name index of the actual directory, kept in SDRIVE.IDX in the
+// root dir of the card (any content, its first contiguous clusters are
+// used, 32 bytes per entry and a sector).  Without that file the search
+// scans the directory and the sorted view is the directory order, as it
+// is until dirIndexStep() in the main loop has built the index.
+
+#define DIRINDEX_NOTFOUND	0xFFFF
+#define DIRINDEX_SORTED		0x8000	// file index is a position in the sorted view
+
+u08 dirIndexInit(void);
+u08 dirIndexUpdate(void);
+u08 dirIndexStep(void);
+u08 dirIndexBusy(void);
+unsigned short dirIndexEntry(unsigned short pos);
+unsigned short dirIndexFind(char *prefix, unsigned short from);
+unsigned short dirIndexLocate(char *prefix);
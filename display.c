@@ -344,17 +344,11 @@ void TFT_scroll(unsigned int scroll) {
 
 void TFT_fill(unsigned int colour)
 {
-    unsigned long index = (unsigned long) X_max * (unsigned long) Y_max;
-
-    TFT_set_display_window(0, 0, (MAX_X - 1), (MAX_Y - 1));
-
-    while(index)
-    {
-       TFT_write_data(colour);
-       index--;
-    };
+    TFT_fill_area(0, 0, (MAX_X - 1), (MAX_Y - 1), colour);
 }
 
+unsigned char (*TFT_yield)();	//if set, called between the rows of big fills
+
 
 void TFT_fill_area(signed int x1, signed int y1, signed int x2, signed int y2, unsigned int colour)
 {
@@ -370,10 +364,26 @@ void TFT_fill_area(signed int x1, signed int y1, signed int x2, signed int y2, u
     }
 
     //index = (x2 - x1) * (y2 - y1);
-    index = ((unsigned)x2 - (unsigned)x1 + 1)*((unsigned)y2 - (unsigned)y1 + 1);
+    index = (unsigned long)((unsigned)x2 - (unsigned)x1 + 1)*((unsigned)y2 - (unsigned)y1 + 1);
     //TFT_set_display_window(x1, y1, (x2 - 1), (y2 - 1));
     TFT_set_display_window(x1, y1, x2, y2);
 
+    //row by row, someone else may draw in between (then the window is gone)
+    if(TFT_yield && index >= TFT_YIELD_AREA)
+    {
+        unsigned int n;
+
+        while(y1 <= y2)
+        {
+            for(n = x2 - x1 + 1; n; n--)
+                TFT_write_data(colour);
+            y1++;
+            if(TFT_yield() && y1 <= y2)
+                TFT_set_display_window(x1, y1, x2, y2);
+        }
+        return;
+    }
+
     while(index)
     {
        TFT_write_data(colour);
@@ -191,6 +191,8 @@ void TFT_scroll_init(unsigned int tfa, unsigned int vsa, unsigned int bfa);
 void TFT_scroll(unsigned int scroll);
 void TFT_fill(unsigned int colour);
 void TFT_fill_area(signed int x1, signed int y1, signed int x2, signed int y2, unsigned int colour);
+extern unsigned char (*TFT_yield)();
+#define TFT_YIELD_AREA	8192	//fills from this size call TFT_yield between the rows
 unsigned int TFT_BGR2RGB(unsigned int colour);
 unsigned int RGB565_converter(unsigned char r, unsigned char g, unsigned char b);
 void swap(signed int *a, signed int *b);
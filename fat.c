@@ -49,11 +49,16 @@
 
 #define FileNameBuffer atari_sector_buffer
 extern unsigned char atari_sector_buffer[256];
-extern unsigned char mmc_sector_buffer[512];	// one sector
 extern struct GlobalSystemValues GS;
 extern struct FileInfoStruct FileInfo;			//< file information for last file accessed
 extern struct flags SDFlags;
 
+// file offset -> SD sector, cluster and the rest, the sizes are powers of 2
+#define OFFSET_SECTOR(o)	((o)>>SectorShift)
+#define OFFSET_CLUSTER(o)	((o)>>(SectorShift+ClusterShift))
+#define SECTOR_OFFSET(o)	((unsigned short)(o)&(BytesPerSector-1))
+#define CLUSTER_SECTOR(s)	((unsigned char)(s)&(SectorsPerCluster-1))
+
 u32 fatClustToSect(u32 clust)
 {
 	u32 ret;
@@ -61,7 +66,7 @@ u32 fatClustToSect(u32 clust)
 		return (u32)((u32)(FirstDataSector) - (u32)(RootDirSectors));
 	}	
 	ret = (u32)(clust-2);
-	ret *= (u32)SectorsPerCluster;
+	ret <<= ClusterShift;
 	ret += (u32)FirstDataSector;
 	return ((u32)ret);
 }
@@ -74,6 +79,56 @@ unsigned char last_dir_sector_count=0;
 u32 last_dir_cluster=0;
 unsigned char last_dir_index=0;
 
+//checkpoint: short name slot of the entry (n+1)*dir_index_step-1,
+//pozice jako last_dir_* (sektor se dopocita z clusteru a seccount)
+struct {
+	u32 cluster;
+	unsigned char seccount;
+	unsigned char index;
+} dir_index[DIR_INDEX_SIZE];
+unsigned char dir_index_count;
+unsigned short dir_index_step;
+//the last directory counted to its end, fatFileCreate() forgets it
+u32 dir_count_cluster;		//its dir_cluster
+unsigned short dir_count;	//entries
+u32 dir_end_cluster;		//cluster it ended in
+unsigned char dir_writes;	//entries created, the sorted index checks it
+
+//jiny adresar nez posledne: zneplatni last_dir polozky i checkpointy
+static void fatDirSync(void)
+{
+	if (FileInfo.vDisk->dir_cluster!=last_dir_start_cluster)
+	{
+		last_dir_start_cluster=FileInfo.vDisk->dir_cluster;
+		last_dir_valid=0;
+		dir_index_count=0;
+		dir_index_step=DIR_INDEX_STEP;
+	}
+}
+
+//entrycount was just counted at this slot, keep it if it is due
+static void fatDirCheckpoint(unsigned short entrycount, u32 cluster, unsigned char seccount, u08 index)
+{
+	if (entrycount == (dir_index_count + 1) * dir_index_step)
+	{
+		if (dir_index_count == DIR_INDEX_SIZE)
+		{
+			//plno: kazdy druhy checkpoint s dvojnasobnym krokem
+			u08 i;
+			for (i=0;i<DIR_INDEX_SIZE/2;i++) dir_index[i]=dir_index[2*i+1];
+			dir_index_count=DIR_INDEX_SIZE/2;
+			dir_index_step<<=1;
+		}
+		else
+		{
+			dir_index[dir_index_count].cluster = cluster;
+			dir_index[dir_index_count].seccount = seccount;
+			dir_index[dir_index_count].index = index;
+			dir_index_count++;
+		}
+	}
+}
+
 //u32 test;
 
 unsigned char fatInit()
@@ -125,10 +180,16 @@ unsigned char fatInit()
 	SectorsPerCluster	= bpb->bpbSecPerClust;
 	BytesPerSector		= bpb->bpbBytesPerSec;
 	FirstFATSector		= bpb->bpbResSectors + PartInfo.prStartLBA;
+	//shifts instead of divisions by the sizes
+	for(SectorShift=0; SectorShift<15 && (1<<SectorShift)<BytesPerSector; SectorShift++);
+	for(ClusterShift=0; ClusterShift<7 && (1<<ClusterShift)<SectorsPerCluster; ClusterShift++);
+	if((1<<SectorShift)!=BytesPerSector || (1<<ClusterShift)!=SectorsPerCluster)
+		return 4; //not a power of 2
 	//FirstFAT2Sector		= bpb->bpbResSectors + PartInfo.prStartLBA + bpb->bpbFATsecs; // bo ao
 
 	//last_dir_start_cluster=0xffff;
 	last_dir_start_cluster=CLUST_EOFE;
+	dir_count_cluster=CLUST_EOFE;
 	//last_dir_valid=0;		//<-- neni potreba, protoze na zacatku fatGetDirEntry se pri zjisteni
 							//ze je (FileInfo.vDisk->dir_cluster!=last_dir_start_cluster)
 							//vynuluje last_dir_valid=0;
@@ -184,21 +245,34 @@ unsigned char fatGetDirEntry(unsigned short entry, unsigned char use_long_names)
 	unsigned short entrycount = 0;
 	u32 actual_cluster = FileInfo.vDisk->dir_cluster;
 	unsigned char seccount=0;
+	unsigned char from_last;
+	unsigned char cp;
 
 	haveLongNameEntry = 0;
 	gotEntry = 0;
 
-	if (FileInfo.vDisk->dir_cluster!=last_dir_start_cluster)
-	{
-		//zmenil se adresar, takze musi pracovat s nim
-		//a zneplatnit last_dir polozky
-		last_dir_start_cluster=FileInfo.vDisk->dir_cluster;
-		last_dir_valid=0;
-	}
+	//zmenil se adresar, takze musi pracovat s nim
+	fatDirSync();
 
-	if ( !last_dir_valid
+	from_last = !( !last_dir_valid
 		 || (entry<=last_dir_entry && (entry!=last_dir_entry || last_dir_valid!=1 || use_long_names!=0))
-	   )
+	   );
+
+	//nejblizsi checkpoint pred entry
+	cp = (entry / dir_index_step < dir_index_count) ? entry / dir_index_step : dir_index_count;
+	if (cp && (!from_last || last_dir_entry < cp * dir_index_step - 1))
+	{
+		//zacne od checkpointu, ta polozka se jeste zapocita
+		cp--;
+		entrycount = (cp + 1) * dir_index_step - 1;
+		actual_cluster = dir_index[cp].cluster;
+		seccount = dir_index[cp].seccount;
+		index = dir_index[cp].index;
+		sector = fatClustToSect(actual_cluster) + seccount - 1;
+		goto fat_read_from_last_entry;
+	}
+	else
+	if (!from_last)
 	{
 		//musi zacit od zacatku
 		sector = fatClustToSect(FileInfo.vDisk->dir_cluster);
@@ -316,7 +390,7 @@ fat_read_from_last_entry:
 					}
 					// otherwise
 					haveLongNameEntry = 0;	// clear long name flag
-					entrycount++;			// increment entry counter		
+					goto fat_count_dir_entry;
 				}
 				else
 				{
@@ -369,10 +443,14 @@ fat_read_from_last_entry:
 						break;
 					}
 					// otherwise
-					entrycount++;			// increment entry counter		
+					goto fat_count_dir_entry;
 				}
 			}
 		}
+		goto fat_next_dir_entry;
+fat_count_dir_entry:
+		entrycount++;			// increment entry counter
+		fatDirCheckpoint(entrycount, actual_cluster, seccount, index);
 fat_next_dir_entry:
 		// next directory entry
 		de++;
@@ -408,6 +486,118 @@ fat_next_dir_entry:
 }
 
 
+// scan of the directory dir (fatScanDirSector() a sector at a time); with
+// count set it may go on from the last checkpoint, or be done already when
+// the directory was counted before and did not change since then
+void fatScanDirStart(dir_scan_t *s, u32 dir, unsigned char count)
+{
+	s->dir = s->cluster = dir;
+	s->seccount = 0;
+	s->index = 16;
+	s->entries = 0;
+	s->writes = dir_writes;
+
+	if (dir == FileInfo.vDisk->dir_cluster)
+		fatDirSync();
+	if (!count) return;
+	if (dir == dir_count_cluster)
+	{
+		//spocitano posledne, konec adresare je znamy
+		s->cluster = dir_end_cluster;
+		s->index = 0xFF;
+		s->entries = dir_count;
+	}
+	else
+	if (dir == last_dir_start_cluster && dir_index_count)
+	{
+		//do posledniho checkpointu uz je spocitano, ta polozka se zapocita znovu
+		u08 cp = dir_index_count - 1;
+		s->entries = (cp + 1) * dir_index_step - 1;
+		s->cluster = dir_index[cp].cluster;
+		s->seccount = dir_index[cp].seccount;
+		s->index = dir_index[cp].index;
+	}
+}
+
+// the next sector of a scan: counts the entries fatGetDirEntry(i,0) finds
+// and sets the checkpoints on the way. With fn, it is called for every entry
+// and for the LFN slots in front of it (with the number of the entry they
+// belong to); fn may use the cache. Returns 0 at the end of the directory,
+// then the count and the cluster it ended in (dir_end_cluster) are kept.
+unsigned char fatScanDirSector(dir_scan_t *s, dir_scan_fn fn)
+{
+	struct direntry *de;
+	u32 sector;
+
+	if (s->index == 0xFF) return 0;	//done
+	if (s->index >= 16)
+	{
+		if ( s->cluster==MSDOSFSROOT )
+		{
+			if (s->seccount>=RootDirSectors && !SDFlags.Fat32Enabled) goto fat_scan_end;
+		}
+		else
+		if( s->seccount>=SectorsPerCluster )
+		{
+			u32 next = fatNextCluster(s->cluster);
+			if (!next) goto fat_scan_end;	//end of the cluster chain
+			s->cluster = next;
+			s->seccount=0;
+		}
+		s->seccount++;
+		s->index = 0;
+	}
+	sector = fatClustToSect(s->cluster) + s->seccount - 1;
+	mmcReadCached( sector );
+	de = ((struct direntry *) mmc_sector_buffer) + s->index;
+	for (; s->index<16; s->index++, de++)
+	{
+		if (de->deName[0] == SLOT_EMPTY) goto fat_scan_end;
+		if (de->deName[0] == SLOT_DELETED) continue;
+		if (de->deAttributes != ATTR_LONG_FILENAME)
+		{
+			//"." adresar a disk label fatGetDirEntry vynechava
+			if ((de->deName[0]=='.' && de->deName[1]==' ' && (de->deAttributes & ATTR_DIRECTORY))
+				|| (de->deAttributes & ATTR_VOLUME)) continue;
+			s->entries++;
+			if (s->dir == last_dir_start_cluster)
+				fatDirCheckpoint(s->entries, s->cluster, s->seccount, s->index);
+		}
+		if (fn)
+		{
+			fn(de, (de->deAttributes == ATTR_LONG_FILENAME) ? s->entries : s->entries-1);
+			mmcReadCached( sector );	//fn may have used the cache
+			de = ((struct direntry *) mmc_sector_buffer) + s->index;
+		}
+	}
+	return 1;
+
+fat_scan_end:
+	s->index = 0xFF;
+	dir_end_cluster = s->cluster;
+	if (s->writes == dir_writes)
+	{
+		//no entry created meanwhile (commands between the sectors)
+		dir_count_cluster = s->dir;
+		dir_count = s->entries;
+	}
+	return 0;
+}
+
+// number of entries fatGetDirEntry(i,0) finds in the actual directory, in
+// one pass over the directory sectors (see fatScanDirSector). Without fn
+// it is the kept count or it goes on from the last checkpoint, with fn it
+// starts at the beginning.
+unsigned short fatScanDirEntries(dir_scan_fn fn)
+{
+	dir_scan_t s;
+
+	fatScanDirStart(&s, FileInfo.vDisk->dir_cluster, !fn);
+	while (fatScanDirSector(&s, fn));
+	return s.entries;
+}
+
+
 u32 fatNextCluster(u32 cluster)
 {
 	u32 nextCluster;
@@ -431,9 +621,9 @@ u32 fatNextCluster(u32 cluster)
 	}
 
 	// calculate the FAT sector that we're interested in
-	sector = FirstFATSector + (fatOffset / ((u32)BytesPerSector));
+	sector = FirstFATSector + OFFSET_SECTOR(fatOffset);
 	// calculate offset of the our entry within that FAT sector
-	offset = fatOffset % ((u32)BytesPerSector);
+	offset = SECTOR_OFFSET(fatOffset);
 
 	// read sector of FAT table
 	mmcReadCached( sector );
@@ -450,85 +640,257 @@ u32 fatNextCluster(u32 cluster)
 	return (nextCluster);
 }
 
+// map the cluster runs of FileInfo.vDisk, call when a file is mounted
+void fatMapClusterRuns(void)
+{
+	virtual_disk_t *vd = FileInfo.vDisk;
+	u32 cluster = vd->start_cluster;
+	u32 next, n;
+	unsigned char r = 0;
+
+	vd->current_cluster = cluster;
+	vd->ncluster = 0;
+	memset(vd->run, 0, sizeof(vd->run));
+	if(cluster < CLUST_FIRST)
+		return;		//empty file
+
+	vd->run[0].cluster = cluster;
+	vd->run[0].count = 1;
+	//no further than the file size, a broken chain could loop
+	n = OFFSET_CLUSTER(vd->size);
+	while(n--)
+	{
+		next = fatNextCluster(cluster);
+		if(!next) break;	//end of chain
+		if(next == cluster+1 && vd->run[r].count != 0xFFFF)
+			vd->run[r].count++;
+		else
+		{
+			if(++r == VDISK_CLUSTER_RUNS) break;	//rest by FAT walk
+			vd->run[r].cluster = next;
+			vd->run[r].count = 1;
+		}
+		cluster = next;
+	}
+}
+
 u32 getClusterN(u32 ncluster)
 {
-        if(ncluster<FileInfo.vDisk->ncluster)
+	virtual_disk_t *vd = FileInfo.vDisk;
+
+	if(vd->run[0].count && vd->run[0].cluster==vd->start_cluster)
+	{
+		u32 n = ncluster;
+		unsigned char r = 0;
+
+		do
+		{
+			if(n < vd->run[r].count)
+			{
+				vd->current_cluster = vd->run[r].cluster + n;
+				vd->ncluster = ncluster;
+				return (vd->current_cluster);
+			}
+			n -= vd->run[r].count;
+		} while(++r < VDISK_CLUSTER_RUNS && vd->run[r].count);
+
+		//behind the mapped runs, walk on from the last mapped cluster
+		n = ncluster - n - 1;
+		if(vd->ncluster < n || ncluster < vd->ncluster)
+		{
+			vd->current_cluster = vd->run[r-1].cluster + vd->run[r-1].count - 1;
+			vd->ncluster = n;
+		}
+	}
+
+        if(ncluster<vd->ncluster)
         {
-                FileInfo.vDisk->current_cluster=FileInfo.vDisk->start_cluster;
-                FileInfo.vDisk->ncluster=0;
+                vd->current_cluster=vd->start_cluster;
+                vd->ncluster=0;
         }
 
-        while(FileInfo.vDisk->ncluster!=ncluster)
+        while(vd->ncluster!=ncluster)
         {
-                FileInfo.vDisk->current_cluster=fatNextCluster(FileInfo.vDisk->current_cluster);
-                FileInfo.vDisk->ncluster++;
+                vd->current_cluster=fatNextCluster(vd->current_cluster);
+                vd->ncluster++;
         }
 
         //return (FileInfo.vDisk->current_cluster&0xFFFF);
-        return (FileInfo.vDisk->current_cluster);
+        return (vd->current_cluster);
 }
 
-unsigned short faccess_offset(char mode, u32 offset_start, unsigned short ncount)
+// the start of a range of the file into the cache, the range cut at the
+// end of file once, not byte by byte; returns the offset in the SD sector
+static unsigned short faccess_seek(u32 offset_start, unsigned short *ncount, unsigned char *nsector)
 {
-        unsigned short j;
-        u32 offset=offset_start;
-        u32 end_of_file;
-        u32 ncluster, nsector, current_sector;
-        u32 bytespercluster=((u32)SectorsPerCluster)*((u32)BytesPerSector);
+        if(((u32)*ncount) > FileInfo.vDisk->size-offset_start)
+                *ncount = (unsigned short)(FileInfo.vDisk->size-offset_start);
 
-        if(offset_start>=FileInfo.vDisk->size)
-                return 0;
-
-        end_of_file = (FileInfo.vDisk->size - offset_start);
-
-        ncluster = offset/bytespercluster;
-        offset-=ncluster*bytespercluster;
+        *nsector = CLUSTER_SECTOR(OFFSET_SECTOR(offset_start));
+        getClusterN(OFFSET_CLUSTER(offset_start));
+        mmcReadCached(fatClustToSect(FileInfo.vDisk->current_cluster) + *nsector);
+        return SECTOR_OFFSET(offset_start);
+}
 
-        nsector = offset/((u32)BytesPerSector);
-        offset-=nsector*((u32)BytesPerSector);
+// the next SD sector of the file into the cache
+static void faccess_next(unsigned char *nsector)
+{
+        if(++*nsector>=SectorsPerCluster)
+        {
+                *nsector=0;
+                getClusterN(FileInfo.vDisk->ncluster+1);
+        }
+        mmcReadCached(fatClustToSect(FileInfo.vDisk->current_cluster) + *nsector);
+}
 
-        getClusterN(ncluster);
+// the file to any buffer, a chunk per SD sector, memcpy() is the tight
+// ld/st loop of avr-libc
+unsigned short faccess_read(u32 offset_start, unsigned char *buff, unsigned short ncount)
+{
+        unsigned short j, n, offset;
+        unsigned char nsector;
 
-        current_sector = fatClustToSect(FileInfo.vDisk->current_cluster) + nsector;
-        mmcReadCached(current_sector);
+        if(offset_start>=FileInfo.vDisk->size)
+                return 0;
 
-        for(j=0;j<ncount;j++,offset++)
+        offset = faccess_seek(offset_start,&ncount,&nsector);
+        for(j=0;;)
         {
-                        if(offset>=((u32)BytesPerSector) )
-                        {
-                                if(mode==FILE_ACCESS_WRITE && mmcWriteCached(0))
-                                        return 0;
+                n = BytesPerSector-offset;
+                if(n > ncount-j)
+                        n = ncount-j;
+                memcpy(buff+j,mmc_sector_buffer+offset,n); //atarisektor<-SDsektor
+                j+=n;
+                if(j>=ncount)
+                        return j;
+                offset=0;
+                faccess_next(&nsector);
+        }
+}
 
-                                offset=0;
-                                nsector++;
+// any buffer to the file, every SD sector is marked for the write-back
+// before the next one comes into the cache
+unsigned short faccess_write(u32 offset_start, unsigned char *buff, unsigned short ncount)
+{
+        unsigned short j, n, offset;
+        unsigned char nsector;
 
-                                if(nsector>=((u32)SectorsPerCluster) )
-                                {
-                                        nsector=0;
-                                        ncluster++;
-                                        getClusterN(ncluster);
-                                }
+        if(offset_start>=FileInfo.vDisk->size)
+                return 0;
 
-                                current_sector = fatClustToSect(FileInfo.vDisk->current_cluster) + nsector;
-                                mmcReadCached(current_sector);
-                        }
+        offset = faccess_seek(offset_start,&ncount,&nsector);
+        for(j=0;;)
+        {
+                n = BytesPerSector-offset;
+                if(n > ncount-j)
+                        n = ncount-j;
+                memcpy(mmc_sector_buffer+offset,buff+j,n); //SDsektor<-atarisektor
+                if(mmcWriteCached(0))
+                        return 0;
+                j+=n;
+                if(j>=ncount)
+                        return j;
+                offset=0;
+                faccess_next(&nsector);
+        }
+}
 
-                if(!end_of_file)
-                        break; //return (j&0xFFFF);
+unsigned short faccess_offset(char mode, u32 offset_start, unsigned short ncount)
+{
+        if(mode==FILE_ACCESS_WRITE)
+                return faccess_write(offset_start,atari_sector_buffer,ncount);
+        return faccess_read(offset_start,atari_sector_buffer,ncount);
+}
 
-                if(mode==FILE_ACCESS_WRITE)
-                        mmc_sector_buffer[offset]=atari_sector_buffer[j]; //SDsektor<-atarisektor
-                else
-                        atari_sector_buffer[j]=mmc_sector_buffer[offset]; //atarisektor<-SDsektor
+// the SD sector with the file offset into the cache, returns the offset in it
+static unsigned short faccess_sector(u32 offset)
+{
+	getClusterN(OFFSET_CLUSTER(offset));
+	mmcReadCached(fatClustToSect(FileInfo.vDisk->current_cluster) + CLUSTER_SECTOR(OFFSET_SECTOR(offset)));
+	mmc_cache_busy|=1<<mmc_cache_line;	//it goes out from there
+	return SECTOR_OFFSET(offset);
+}
 
-                end_of_file--;
+// a range of the file to send without copying: part[0] and, if the range
+// straddles two SD sectors, part[1] point into the sector cache, with one
+// cache line the head of a straddling range is copied to atari_sector_buffer
+// the lines stay untouched until the frame is out (mmc_cache_busy)
+// return: 0 use faccess_offset, else ok
+unsigned char faccess_map(u32 offset_start, unsigned short ncount, struct faccess_part *part)
+{
+	u32 first=OFFSET_SECTOR(offset_start);
+	u32 last=OFFSET_SECTOR(offset_start+ncount-1);
+	unsigned short n;
+
+	if(!ncount || offset_start+ncount>FileInfo.vDisk->size)
+		return 0;	//faccess_offset knows what to do at the end of file
+	part[1].len=0;
+	if(first!=last)
+	{
+#if MMC_CACHE_SECTORS == 1
+		n=BytesPerSector-SECTOR_OFFSET(offset_start);
+		if(faccess_offset(FILE_ACCESS_READ,offset_start,n)!=n)
+			return 0;
+		part[0].ptr=atari_sector_buffer;
+#else
+		n=faccess_sector(offset_start);	//it moves mmc_sector_buffer to the line
+		part[0].ptr=mmc_sector_buffer+n;
+		n=BytesPerSector-n;
+#endif
+		part[0].len=n;
+		part++;
+		offset_start+=n;
+		ncount-=n;
+	}
+	n=faccess_sector(offset_start);
+	part[0].ptr=mmc_sector_buffer+n;
+	part[0].len=ncount;
+	return 1;
+}
 
-        }
+// zero the file from offset_start to its end, the whole sectors with
+// multiple block writes over contiguous sectors
+// atari_sector_buffer gets cleared
+// return: 0 ok, 1 error
+unsigned char faccess_zero(u32 offset_start)
+{
+	u32 offset=offset_start;
+	u32 size=FileInfo.vDisk->size;
+	u32 first=0, count=0;	//pending range of sectors
+	u32 nsector, sector, n;
+	unsigned short len;
 
-        if(mode==FILE_ACCESS_WRITE && mmcWriteCached(0))
-                return 0;
+	memset(atari_sector_buffer,0,256);
 
-        return (j&0xFFFF);
+	//up to the next sector boundary and the end behind the last whole
+	//sector by the normal write, that keeps the rest of these sectors
+	while(offset<size)
+	{
+		if(!SECTOR_OFFSET(offset) && size-offset>=BytesPerSector)
+		{
+			nsector = CLUSTER_SECTOR(OFFSET_SECTOR(offset));
+			sector = fatClustToSect(getClusterN(OFFSET_CLUSTER(offset))) + nsector;
+			n = SectorsPerCluster - nsector;
+			if(n > OFFSET_SECTOR(size-offset))
+				n = OFFSET_SECTOR(size-offset);
+			if(count && sector!=first+count)
+			{
+				if(mmcWriteZero(first,count)) return 1;
+				count=0;
+			}
+			if(!count) first=sector;
+			count+=n;
+			offset+=n<<SectorShift;
+			continue;
+		}
+		len = BytesPerSector - SECTOR_OFFSET(offset);
+		if(len>256) len=256;
+		if(len>size-offset) len=size-offset;
+		if(!faccess_offset(FILE_ACCESS_WRITE,offset,len)) return 1;
+		offset+=len;
+	}
+	if(count && mmcWriteZero(first,count)) return 1;
+	return 0;
 }
 
 // return: 0 ok, 1 error
@@ -623,7 +985,7 @@ u32 fatFileCreate (char *fileName, u32 fileSize) {
 		fatMask = FAT16_MASK;
 	}
 
-	struct direntry * de = (struct direntry*) mmc_sector_buffer;
+	struct direntry * de;
 	u32 clusterNo = 0;
 
 	//printf("newentry: %i\n", entryNo);
@@ -633,6 +995,7 @@ u32 fatFileCreate (char *fileName, u32 fileSize) {
 
 	//record cluster as start cluster
 	mmcReadCached(dirSectNo);	//reread dir sector
+	de = (struct direntry*) mmc_sector_buffer;	//may be another cache line
 	de[entryNo].deHighClust = clusterNo >> 16;
 	de[entryNo].deStartCluster = clusterNo & 0xFFFF;
 	strncpy(de[entryNo].deName,fileName,8);
@@ -642,6 +1005,8 @@ u32 fatFileCreate (char *fileName, u32 fileSize) {
 
 	//mmcWrite(dirSectNo);			//direct use of mmcWrite doesn't check write protect!
 						// and we can use mmcWriteCached also, because it's the same sector
+	dir_count_cluster=CLUST_EOFE;		//one more entry
+	dir_writes++;
 	if (mmcWriteCached(0)) return(0);	//save new entry, exit on write error
 
 	firstSec = fatClustToSect(clusterNo);	//remember first file sector to return
@@ -703,6 +1068,7 @@ u32 fatFileCreate (char *fileName, u32 fileSize) {
 
 	if(full) {	//if no more free clusters, correct file size
 		mmcReadCached(dirSectNo);	//reread dir sector
+		de = (struct direntry*) mmc_sector_buffer;
 		de[entryNo].deFileSize = ((NrOfClusters+1) * BytesPerSector * SectorsPerCluster);
 		mmcWriteCached(1);			//save new entry
 	}
@@ -387,8 +387,35 @@ struct winentry {
 #define FLAGS_ATXTYPE		0x02
 #define FLAGS_DRIVEON		0x01
 
+// the flags are the geometry of an ATR/XFD image: log2 of the sector size
+// (the first three sectors are always 128 bytes)
+#define ATR_SECTOR_SHIFT(flags)	(((flags) & FLAGS_ATRDOUBLESECTORS)? 8 : 7)
+
+// Cluster runs mapped per vDisk on mount (6 bytes each). Contiguous images
+// need one, clusters behind the last run are found by walking the FAT.
+#ifndef VDISK_CLUSTER_RUNS
+#define VDISK_CLUSTER_RUNS	2
+#endif
+
+// Directory checkpoints (6 bytes each), fatGetDirEntry() starts from the
+// nearest one instead of the first directory sector. One every
+// DIR_INDEX_STEP entries, the step doubles when the directory is longer
+// than DIR_INDEX_SIZE steps (keep it even).
+#ifndef DIR_INDEX_SIZE
+#define DIR_INDEX_SIZE		4
+#endif
+#ifndef DIR_INDEX_STEP
+#define DIR_INDEX_STEP		16
+#endif
+
 // Stuctures
-typedef struct				//4+4+4+4+2+4+1=23
+typedef struct				//4+2=6
+{
+	u32 cluster;			//< first cluster of the run
+	unsigned short count;		//< clusters in the run, 0=unused
+}cluster_run_t;
+
+typedef struct				//4+4+4+4+2+4+1=23 (+runs)
 {
 	u32 start_cluster;		//< file starting cluster
 	u32 dir_cluster;		//< dir cluster
@@ -397,8 +424,11 @@ typedef struct				//4+4+4+4+2+4+1=23
 	unsigned short file_index;	//< file index
 	u32 size;			//< file size
 	unsigned char flags;		//< file flags
+	cluster_run_t run[VDISK_CLUSTER_RUNS];	//< valid if run[0].cluster==start_cluster
 }virtual_disk_t;
 
+#define VDISK_INFO_SIZE		23	// part of virtual_disk_t sent by $DA
+
 struct FileInfoStruct
 {
 	unsigned char Attr;		//< file attr for last file accessed
@@ -409,7 +439,7 @@ struct FileInfoStruct
 	virtual_disk_t *vDisk;
 };
 
-struct GlobalSystemValues		//4+4+2+2+1+4=17 bytes
+struct GlobalSystemValues		//4+4+4+4+2+2+1+4+1+1=27 bytes
 {
 	u32 SectorsTotal;
 	u32 FirstFATSector;
@@ -419,8 +449,12 @@ struct GlobalSystemValues		//4+4+2+2+1+4=17 bytes
 	unsigned short BytesPerSector;
 	unsigned char SectorsPerCluster;
 	u32 RootDirCluster;
+	unsigned char SectorShift;	//log2(BytesPerSector)
+	unsigned char ClusterShift;	//log2(SectorsPerCluster)
 };
 
+#define GS_INFO_SIZE		25	// part of GlobalSystemValues sent by $DA
+
 #define SectorsTotal		GS.SectorsTotal
 #define FirstFATSector		GS.FirstFATSector
 #define FATSectors		GS.FATSectors
@@ -428,6 +462,8 @@ struct GlobalSystemValues		//4+4+2+2+1+4=17 bytes
 #define RootDirSectors		GS.RootDirSectors
 #define BytesPerSector		GS.BytesPerSector
 #define SectorsPerCluster	GS.SectorsPerCluster
+#define SectorShift		GS.SectorShift
+#define ClusterShift		GS.ClusterShift
 #define RootDirCluster		GS.RootDirCluster
 
 #define FILE_ACCESS_READ        0
@@ -437,9 +473,32 @@ unsigned char fatInit();
 u32 fatClustToSect(u32 clust);
 //unsigned char fatChangeDirectory(unsigned short entry);
 unsigned char fatGetDirEntry(unsigned short entry, unsigned char use_long_names);
+typedef void (*dir_scan_fn)(struct direntry *de, unsigned short entry);
+typedef struct				//4+4+1+1+2+1=13
+{
+	u32 dir;			//< dir_cluster of the directory
+	u32 cluster;			//< cluster of the actual sector
+	unsigned char seccount;		//< sectors of it read (as in fatGetDirEntry)
+	u08 index;			//< next slot of the sector, 16=next sector, 0xFF=done
+	unsigned short entries;		//< entries counted so far
+	unsigned char writes;		//< dir_writes at the start
+}dir_scan_t;
+void fatScanDirStart(dir_scan_t *s, u32 dir, unsigned char count);
+unsigned char fatScanDirSector(dir_scan_t *s, dir_scan_fn fn);
+unsigned short fatScanDirEntries(dir_scan_fn fn);
+#define fatCountDirEntries()	fatScanDirEntries(0)
 u32 fatNextCluster(u32 cluster);
+void fatMapClusterRuns(void);
 u32 getClusterN(u32 ncluster);
 unsigned short faccess_offset(char mode, u32 offset_start, unsigned short ncount);
+unsigned short faccess_read(u32 offset_start, unsigned char *buff, unsigned short ncount);
+unsigned short faccess_write(u32 offset_start, unsigned char *buff, unsigned short ncount);
+struct faccess_part {
+	unsigned char *ptr;
+	unsigned short len;
+};
+unsigned char faccess_map(u32 offset_start, unsigned short ncount, struct faccess_part *part);
+unsigned char faccess_zero(u32 offset_start);
 u32 fatFileNew (u32 size);
 
 #endif
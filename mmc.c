@@ -40,14 +40,31 @@
 #include "global.h"
 #include "mmc.h"
 #include "fat.h"
+#include "usart.h"
 #include "display.h"
 // include project-specific hardware configuration
 #include "mmcconf.h"
 
-u32 n_actual_mmc_sector;
-u08 n_actual_mmc_sector_needswrite;
-extern unsigned char mmc_sector_buffer[512];
+// sector cache, see mmc.h
+#if MMC_CACHE_SECTORS > 1
+unsigned char mmc_cache_buffer[MMC_CACHE_SECTORS][512];
+unsigned char *mmc_sector_buffer = mmc_cache_buffer[0];
+u08 mmc_cache_lru[MMC_CACHE_SECTORS];	// line numbers, most recently used first
+#else
+unsigned char mmc_sector_buffer[512];	// one SD sector
+#endif
+u32 mmc_cache_sector[MMC_CACHE_SECTORS];	// 0xFFFFFFFF = empty line
+u08 mmc_cache_needswrite[MMC_CACHE_SECTORS];
+u08 mmc_cache_line;				// line of mmc_sector_buffer
+u08 mmc_cache_busy;				// see mmc.h
+struct mmc_cache_stats mmc_stats;
 struct flags SDFlags;
+static u08 mmc_write_busy;	// the card still programs the last mmcWrite()
+
+// multiple block read (CMD18)
+u32 mmc_stream_sector;		// next sector of the open read
+u08 mmc_stream_open;
+u32 mmc_last_read;		// sector of the last read from the card
 
 unsigned char crc7 (unsigned char crc, unsigned char *pc, unsigned int len) { 
 	//unsigned int i; 
@@ -85,10 +102,18 @@ u08 mmcReset(void)
 	u08 *buffer=mmc_sector_buffer;
 	u08 *b=mmc_sector_buffer;
 
-	n_actual_mmc_sector=0xFFFFFFFF;	//!!! pridano dovnitr
-	n_actual_mmc_sector_needswrite=0;
+	//!!! pridano dovnitr
+	//the buffer is used for the responses below, so forget all lines
+	for(i=0; i<MMC_CACHE_SECTORS; i++) {
+		mmc_cache_sector[i]=0xFFFFFFFF;
+		mmc_cache_needswrite[i]=0;
+#if MMC_CACHE_SECTORS > 1
+		mmc_cache_lru[i]=i;
+#endif
+	}
 
 	SDFlags.SDHC = 0;	// reset SDHC-Flag
+	mmc_stream_open = 0;	// CMD0 ends an open read anyway
 
 	//
 	//i=0xff; //255x
@@ -182,6 +207,7 @@ u08 mmcSendCommand(u08 cmd, u32 arg)
 {
 	u08 r1;
 
+	mmcStreamStop();
 	// assert chip select
 	cbi(MMC_CS_PORT,MMC_CS_PIN);
 	// issue the command
@@ -193,15 +219,36 @@ u08 mmcSendCommand(u08 cmd, u32 arg)
 	return r1;
 }
 
-u08 mmcRead(u32 sector)
+// read the data block of a read command, chip select is asserted
+static u08 mmcReadBlock(void)
 {
 	u08 r1;
-	u16 i;
 	u08 *buffer=mmc_sector_buffer;	//natvrdo!
 
+	// wait for block start
+	while((r1 = spiTransferFF()) == 0xFF);
+	if(r1 != MMC_STARTBLOCK_READ) return r1;	// data error token
+
+	//zacatek bloku
+
+	//nacti 512 bytu
+	spiReceiveBlock(buffer,0x200);
+
+	// read 16-bit CRC
+	//2x FF:
+	spiTransferFF();
+	spiTransferFF();
+	return 0;
+}
+
+u08 mmcRead(u32 sector)
+{
+	u08 r1;
+
 	//too expensive for atx support!
 	//Draw_Circle(15,5,3,1,Green);
 
+	mmcStreamStop();
 	// assert chip select
 	cbi(MMC_CS_PORT,MMC_CS_PIN);
 	// issue command
@@ -209,38 +256,88 @@ u08 mmcRead(u32 sector)
 	r1 = mmcCommand(MMC_READ_SINGLE_BLOCK, sector);
 
 	// check for valid response
-	if(r1 != 0x00) return r1;
+	if(r1 == 0x00) r1 = mmcReadBlock();
 
-	// wait for block start
-	while(spiTransferFF() != MMC_STARTBLOCK_READ);
-
-	//zacatek bloku
-
-	//nacti 512 bytu
-	i=0x200;	//512
-	do { *buffer++ = spiTransferFF(); i--; } while(i);
-
-	// read 16-bit CRC
-	//2x FF:
-	spiTransferFF();
-	spiTransferFF();
 	// release chip select
 	sbi(MMC_CS_PORT,MMC_CS_PIN);
 	spiTransferFF();	// send 8 clocks at end
 	//
 	//Draw_Circle(15,5,3,1,Black);
+	return r1;	//0=success
+}
+
+u08 mmcReadStream(u32 sector)
+{
+	u08 r1;
+
+	if(mmc_stream_open && sector != mmc_stream_sector)
+		mmcStreamStop();
+
+	// chip select stays asserted while the read is open
+	cbi(MMC_CS_PORT,MMC_CS_PIN);
+	if(!mmc_stream_open)
+	{
+		r1 = mmcCommand(MMC_READ_MULTIPLE_BLOCK, SDFlags.SDHC ? sector : sector<<9);
+		if(r1 != 0x00) goto stream_error;
+		mmc_stream_open = 1;
+		mmc_stream_sector = sector;
+	}
+	r1 = mmcReadBlock();
+	if(r1 != 0x00) goto stream_error;
+	mmc_stream_sector++;
 	return 0;	//success
+
+stream_error:
+	mmcStreamStop();
+	sbi(MMC_CS_PORT,MMC_CS_PIN);
+	spiTransferFF();	// send 8 clocks at end
+	return r1;
+}
+
+void mmcStreamStop(void)
+{
+	u08 retry=0xff;
+
+	if(!mmc_stream_open) return;
+	mmc_stream_open = 0;
+
+	cbi(MMC_CS_PORT,MMC_CS_PIN);
+	spiTransferByte(0x40|MMC_STOP_TRANSMISSION);
+	spiTransferByte(0);
+	spiTransferByte(0);
+	spiTransferByte(0);
+	spiTransferByte(0);
+	spiTransferByte(0x61);	// crc of CMD12 with arg 0
+	// the byte after CMD12 is a stuff byte, then R1
+	spiTransferFF();
+	while((spiTransferFF() & 0x80) && --retry);
+	// wait until card not busy
+	while(!spiTransferFF());
+	sbi(MMC_CS_PORT,MMC_CS_PIN);
+	spiTransferFF();	// send 8 clocks at end
 }
 
 u08 mmcWrite(u32 sector)
 {
 	u08 r1;
-	u16 i;
 	u08 *buffer=mmc_sector_buffer;	//natvrdo!
+#if MMC_CACHE_SECTORS > 1
+	u08 i;
+#endif
 
         //LED_RED_ON;	//TODO
 	//Draw_Circle(15,5,3,1,Red);
 
+	mmcStreamStop();
+#if MMC_CACHE_SECTORS > 1
+	//a copy of this sector in another line is outdated now
+	for(i=0; i<MMC_CACHE_SECTORS; i++)
+		if(mmc_cache_sector[i]==sector && mmc_cache_buffer[i]!=buffer) {
+			mmc_cache_sector[i]=0xFFFFFFFF;
+			mmc_cache_needswrite[i]=0;
+		}
+#endif
+
 	// assert chip select
 	cbi(MMC_CS_PORT,MMC_CS_PIN);
 	// issue command
@@ -255,8 +352,7 @@ u08 mmcWrite(u32 sector)
 	spiTransferByte(MMC_STARTBLOCK_WRITE);
 
 	// write data (512 bytes)
-	i=0x200;
-	do { spiTransferByte(*buffer++); i--; }	while(i);
+	spiSendBlock(buffer,0x200);
 
 	// write 16-bit CRC (dummy values)
 	//2x FF:
@@ -266,8 +362,9 @@ u08 mmcWrite(u32 sector)
 	r1 = spiTransferFF();
 	if( (r1&MMC_DR_MASK) != MMC_DR_ACCEPT)
 		return r1;
-	// wait until card not busy
-	while(!spiTransferFF());
+	// the card programs the sector now, the next command waits for it
+	// (mmcCommand()), meanwhile the SIO frames go on
+	mmc_write_busy = 1;
 	// release chip select
 	sbi(MMC_CS_PORT,MMC_CS_PIN);
 	spiTransferFF();	// send 8 clocks at end
@@ -279,6 +376,64 @@ u08 mmcWrite(u32 sector)
 	return 0;
 }
 
+u08 mmcWriteZero(u32 sector, u32 count)
+{
+	u08 r1;
+	u16 i;
+
+	//the cache must not write old data over the range later
+	for(i=0; i<MMC_CACHE_SECTORS; i++)
+		if(mmc_cache_sector[i]-sector < count) {
+			mmc_cache_sector[i]=0xFFFFFFFF;
+			mmc_cache_needswrite[i]=0;
+		}
+
+	// pre-erase, only a hint for the card (MMC does not know it)
+	if(mmcSendCommand(MMC_APP_CMD, 0) <= 1)
+		mmcSendCommand(MMC_SD_SET_WR_BLK_ERASE_COUNT, count);	// ACMD23
+
+	// assert chip select
+	cbi(MMC_CS_PORT,MMC_CS_PIN);
+	// issue command
+	if (!SDFlags.SDHC) sector<<=9;
+	r1 = mmcCommand(MMC_WRITE_MULTIPLE_BLOCK, sector);
+	// check for valid response
+	if(r1 != 0x00)
+		goto write_end;
+	// send dummy
+	spiTransferFF();
+
+	do
+	{
+		// send data start token
+		spiTransferByte(MMC_STARTBLOCK_MWRITE);
+		// write data (512 bytes)
+		i=0x200;
+		do { spiTransferByte(0); i--; } while(i);
+		// write 16-bit CRC (dummy values)
+		spiTransferFF();
+		spiTransferFF();
+		// read data response token
+		r1 = spiTransferFF();
+		// wait until card not busy
+		while(!spiTransferFF());
+		if( (r1&MMC_DR_MASK) != MMC_DR_ACCEPT)
+			break;
+		r1 = 0;
+	} while(--count);
+
+	// stop transmission, the card gets busy after one byte
+	spiTransferByte(MMC_STOPTRAN_WRITE);
+	spiTransferFF();
+	while(!spiTransferFF());
+
+write_end:
+	// release chip select
+	sbi(MMC_CS_PORT,MMC_CS_PIN);
+	spiTransferFF();	// send 8 clocks at end
+	return r1;
+}
+
 u08 mmcCommand(u08 cmd, u32 arg)
 {
 	u08 r1;
@@ -292,6 +447,12 @@ u08 mmcCommand(u08 cmd, u32 arg)
 	spiTransferFF();	//pridano navic! 27.6.2008 doporucil Bob!k
 	spiTransferFF();	//pridano navic! 27.6.2008 doporucil Bob!k
 */
+	// wait until card not busy with the last write
+	if(mmc_write_busy)
+	{
+		while(!spiTransferFF());
+		mmc_write_busy = 0;
+	}
 	cmd |= 0x40;
 	// send command
 	spiTransferByte(cmd);
@@ -324,57 +485,152 @@ u08 mmcCommand(u08 cmd, u32 arg)
 	return r1;
 }
 
+#if MMC_CACHE_SECTORS > 1
+// make line the actual one and the most recently used
+static void mmcCacheSelect(u08 line)
+{
+	u08 i;
+
+	i=0;
+	while(mmc_cache_lru[i]!=line) i++;
+	for( ; i; i--) mmc_cache_lru[i]=mmc_cache_lru[i-1];
+	mmc_cache_lru[0]=line;
+	mmc_cache_line=line;
+	mmc_sector_buffer=mmc_cache_buffer[line];
+}
+#endif
+
+// write back one line of the cache
+static void mmcCacheWriteLine(u08 line)
+{
+	u08 ret,retry;
+#if MMC_CACHE_SECTORS > 1
+	unsigned char *actual=mmc_sector_buffer;
+
+	mmc_sector_buffer=mmc_cache_buffer[line];	//mmcWrite() takes mmc_sector_buffer
+#endif
+	retry=16; //maximal 16x tries
+	do
+	{
+		ret = mmcWrite(mmc_cache_sector[line]); //returns 0 if ok
+		retry--;
+	} while (ret && retry);
+	while(ret); //and if it did not work, SDrive blocks it!
+	mmc_cache_needswrite[line] = 0;
+	mmc_stats.writes++;
+#if MMC_CACHE_SECTORS > 1
+	mmc_sector_buffer=actual;
+#endif
+}
+
 u08 mmcReadCached(u32 sector)
 {
-        if(sector==n_actual_mmc_sector) return(-1);
-
-        u08 ret,retry;
-        //save cache before read another sector
-        mmcWriteCachedFlush();
-        //from now on
-        retry=0; //maximal 256x tries
-        do
-        {
-                ret = mmcRead(sector);  //returns 0 if ok
-                retry--;
-        } while (ret && retry);
-        if(ret)	// exit on error
+	u08 line;
+
+	for(line=0; line<MMC_CACHE_SECTORS; line++)
+	{
+		if(sector==mmc_cache_sector[line])
+		{
+#if MMC_CACHE_SECTORS > 1
+			mmcCacheSelect(line);
+#endif
+			mmc_stats.hits++;
+			return(0);
+		}
+	}
+
+	u08 ret,retry;
+#if MMC_CACHE_SECTORS > 1
+	//replace the least recently used line
+	line=mmc_cache_lru[MMC_CACHE_SECTORS-1];
+	mmcCacheSelect(line);
+#else
+	line=0;
+#endif
+	//a frame may still go out of this line
+	if(mmc_cache_busy & (1<<line))
+	{
+		USART_Wait_Tx();
+		mmc_cache_busy&=~(1<<line);
+	}
+	//save cache before read another sector
+	if(mmc_cache_needswrite[line]) mmcCacheWriteLine(line);
+	mmc_stats.misses++;
+	//from now on
+	retry=0; //maximal 256x tries
+	do
+	{
+		//sequential reads go to a multiple block read
+		if(mmc_stream_open ? sector==mmc_stream_sector : sector==mmc_last_read+1)
+			ret = mmcReadStream(sector);	//returns 0 if ok
+		else
+			ret = mmcRead(sector);		//returns 0 if ok
+		retry--;
+	} while (ret && retry);
+	mmc_last_read=sector;
+	if(ret) {	// exit on error, the buffer is garbage now
+		mmc_cache_sector[line]=0xFFFFFFFF;
 		return(-1);
-        n_actual_mmc_sector=sector;
+	}
+	mmc_cache_sector[line]=sector;
 	return(0);
 }
 
 u08 mmcWriteCached(unsigned char force)
 {
-        //if ( get_readonly() ) return 0xff; //zakazany zapis
-        //LED_RED_ON;	//signal cache is not written yet
+	//if ( get_readonly() ) return 0xff; //zakazany zapis
+	//LED_RED_ON;	//signal cache is not written yet
 	Draw_Circle(15,5,3,1,Red);
-        if (force)
-        {
-                u08 ret,retry;
-                retry=16; //maximal 16x tries
-                do
-                {
-                        ret = mmcWrite(n_actual_mmc_sector); //returns 0 if ok
-                        retry--;
-                } while (ret && retry);
-                while(ret); //and if it did not work, SDrive blocks it!
-                n_actual_mmc_sector_needswrite = 0;
-                //LED_RED_OFF;
+	if (force)
+	{
+		mmcCacheWriteLine(mmc_cache_line);
+		//LED_RED_OFF;
 		Draw_Circle(15,5,3,1,Black);
-        }
-        else
-        {
-                n_actual_mmc_sector_needswrite=1;
-        }
-        return 0; //return 0 if ok
+	}
+	else
+	{
+		mmc_cache_needswrite[mmc_cache_line]=1;
+	}
+	return 0; //return 0 if ok
+}
+
+// a line waits for its write-back
+u08 mmcCacheDirty(void)
+{
+	u08 line;
+
+	for(line=0; line<MMC_CACHE_SECTORS; line++)
+		if(mmc_cache_needswrite[line]) return 1;
+	return 0;
+}
+
+// the card still programs the last write? one look, no wait (mmcCommand()
+// waits for it)
+u08 mmcWriteBusy(void)
+{
+	if(mmc_write_busy)
+	{
+		cbi(MMC_CS_PORT,MMC_CS_PIN);
+		if(spiTransferFF())	// the card holds DO low while busy
+			mmc_write_busy = 0;
+		sbi(MMC_CS_PORT,MMC_CS_PIN);
+		spiTransferFF();	// send 8 clocks at end
+	}
+	return mmc_write_busy;
 }
 
 void mmcWriteCachedFlush()
 {
-        if (n_actual_mmc_sector_needswrite)
-        {
-         while (mmcWriteCached(1)); //if it's forbidden to write, SDrive blocks it!
-	//until the write is not allowed (you are hanging something in the cache)
-        }
+	u08 line;
+	u08 written=0;
+
+	for(line=0; line<MMC_CACHE_SECTORS; line++)
+	{
+		if (mmc_cache_needswrite[line])
+		{
+			mmcCacheWriteLine(line);
+			written++;
+		}
+	}
+	if(written) Draw_Circle(15,5,3,1,Black);
 }
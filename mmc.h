@@ -73,10 +73,13 @@
 #define MMC_SEND_IF_COND		8		///< set card interface coditions(SDHC)
 #define MMC_SEND_CSD			9		///< get card's CSD
 #define MMC_SEND_CID			10		///< get card's CID
+#define MMC_STOP_TRANSMISSION		12		///< end a multiple block read
 #define MMC_SEND_STATUS			13
 #define MMC_SET_BLOCKLEN		16		///< Set number of bytes to transfer per block
 #define MMC_READ_SINGLE_BLOCK		17		///< read a block
+#define MMC_READ_MULTIPLE_BLOCK		18		///< read blocks until MMC_STOP_TRANSMISSION
 #define MMC_WRITE_BLOCK			24		///< write a block
+#define MMC_WRITE_MULTIPLE_BLOCK	25		///< write blocks until MMC_STOPTRAN_WRITE
 #define MMC_PROGRAM_CSD			27
 #define MMC_SET_WRITE_PROT		28
 #define MMC_CLR_WRITE_PROT		29
@@ -93,6 +96,7 @@
 #define MMC_CRC_ON_OFF			59		///< Turns CRC check on/off
 // APP_CMDs
 #define MMC_SD_SEND_OP_COND		41		//< set capacity and init
+#define MMC_SD_SET_WR_BLK_ERASE_COUNT	23		//< pre-erase blocks of the next multiple block write
 // R1 Response bit-defines
 #define MMC_R1_BUSY			0x80		///< R1 response: bit indicates card is busy
 #define MMC_R1_PARAMETER		0x40
@@ -126,6 +130,39 @@ struct flags {
         unsigned char Fat32Enabled : 1;
 };
 
+// Sector cache
+// Every line holds one 512 byte SD sector, lines are replaced least
+// recently used first and written back when dirty. Each line costs
+// 512 bytes of SRAM, the ATmega328 has room for one line beside the
+// display buffers, so more lines are for bigger chips (or the host
+// simulation). With one line the cache works like the old
+// n_actual_mmc_sector cache: four 128 byte sectors of an ATR share a line
+// and a FAT sector serves 128 clusters, so on the hostsim bench one line
+// already serves 88% of the reads of a boot, a second line saves 3 of 15
+// card reads there and 2% of the time of the index sort.
+#ifndef MMC_CACHE_SECTORS
+#define MMC_CACHE_SECTORS		1
+#endif
+
+#if MMC_CACHE_SECTORS > 1
+extern unsigned char *mmc_sector_buffer;	// line of the last mmcReadCached()
+#else
+extern unsigned char mmc_sector_buffer[512];
+#endif
+
+// lines the transmitter may still send from (bit per line), they are only
+// replaced after USART_Wait_Tx(); writes to them come with the next command,
+// which waits for the transmitter first
+extern u08 mmc_cache_busy;
+extern u08 mmc_cache_line;
+
+struct mmc_cache_stats {
+	u32 hits;		// mmcReadCached() served from the cache
+	u32 misses;		// sectors read from the card
+	u32 writes;		// cached sectors written to the card
+};
+extern struct mmc_cache_stats mmc_stats;
+
 // functions
 
 //! Initialize AVR<->MMC hardware interface.
@@ -144,16 +181,38 @@ u08 mmcSendCommand(u08 cmd, u32 arg);
 /// Returns zero if successful.
 u08 mmcRead(u32 sector);
 
+//! Read 512-byte sector from card to buffer with a multiple block read.
+/// The read stays open for the following sector, any other card access
+/// closes it. Returns zero if successful.
+u08 mmcReadStream(u32 sector);
+
+//! Close an open multiple block read.
+void mmcStreamStop(void);
+
 //! Write 512-byte sector from buffer to card
 /// Returns zero if successful.
 u08 mmcWrite(u32 sector);
 
+//! Write count zeroed 512-byte sectors from sector on with one
+/// multiple block write, pre-erased (SD only). Cached copies are dropped.
+/// Returns zero if successful.
+u08 mmcWriteZero(u32 sector, u32 count);
+
 //! Internal command function.
 /// Issues a generic MMC command as specified by cmd and arg.
 u08 mmcCommand(u08 cmd, u32 arg);
 
+//! Mark the sector of the last mmcReadCached() as changed.
+/// With force != 0 it is written to the card at once.
 u08 mmcWriteCached(unsigned char force);
+//! Write all changed sectors of the cache to the card.
 void mmcWriteCachedFlush();
+//! Nonzero if a sector of the cache waits for its write-back.
+u08 mmcCacheDirty(void);
+//! Nonzero while the card programs the last write, without waiting.
+u08 mmcWriteBusy(void);
+//! Make sector the actual one in mmc_sector_buffer.
+/// Returns zero if read from card or cached, (u08)-1 on error.
 u08 mmcReadCached(u32 sector);
 
 #endif
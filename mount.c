@@ -0,0 +1,113 @@
+// Mount records: mount_store[drive] keeps where the directory entry of the
+// image is (SD sector and index) and what the mount found out, so on boot
+// one sector read checks that the entry is still the same file (first
+// cluster and size), instead of a directory walk up to file_index and the
+// image header.  Every mount ($F0-$F4) writes the record of its drive, the
+// boot takes it only for the image Cfg SaveIm keeps in image_store.
+//
+// The records are the only EEMEM of this file and mount.o links last, so
+// they come behind the older eeprom layout (percom table, XEX loader,
+// image_store, cfg and the touch calibration stay where they were).
+
+#include <avr/eeprom.h>
+#include <string.h>
+#include "avrlibdefs.h"         // global AVRLIB defines
+#include "avrlibtypes.h"        // global AVRLIB types definitions
+#include "global.h"
+#include "fat.h"
+#include "mmc.h"
+#include "tft.h"
+
+extern unsigned char atari_sector_buffer[256];
+extern struct FileInfoStruct FileInfo;
+extern virtual_disk_t vDisk[DEVICESNUM];
+extern virtual_disk_t tmpvDisk;
+extern u32 last_dir_sector;	//where fatGetDirEntry() found its entry
+extern unsigned char last_dir_index;
+extern struct file_save image_store[] EEMEM;
+
+struct mount_record mount_store[DEVICESNUM] EEMEM = {[0 ... DEVICESNUM-1] = { 0xffffffff, 0xffff, 0xffffffff, 0xff, 0xffffffff, 0xffffffff, 0xff }};
+
+//Cfg SaveIm: D1-D4 (0-indexed in image_store) for the next boot
+void save_images()
+{
+	unsigned char i;
+
+	for(i = 0; i < DEVICESNUM-1; i++) {
+		if(vDisk[i+1].flags & FLAGS_DRIVEON) {
+			eeprom_update_dword(&image_store[i].dir_cluster, vDisk[i+1].dir_cluster);
+			eeprom_update_word(&image_store[i].file_index, vDisk[i+1].file_index);
+		}
+		else {
+			eeprom_update_dword(&image_store[i].dir_cluster, 0xffffffff);
+		}
+	}
+}
+
+//record of vDisk[drive] to the eeprom, for an empty drive only dir_cluster
+void mount_save(unsigned char drive)
+{
+	virtual_disk_t *vd = &vDisk[drive];
+	virtual_disk_t *actual = FileInfo.vDisk;
+	u32 dir_cluster = tmpvDisk.dir_cluster;
+	struct mount_record mr;
+
+	if(!(vd->flags & FLAGS_DRIVEON)) {
+		eeprom_update_dword(&mount_store[drive].dir_cluster, 0xffffffff);
+		return;
+	}
+	mr.dir_cluster = vd->dir_cluster;
+	mr.file_index = vd->file_index;
+	mr.dir_sector = 0xffffffff;	//no record, mount by file_index
+	mr.dir_index = 0xff;
+	mr.start_cluster = vd->start_cluster;
+	mr.size = vd->size;
+	mr.flags = vd->flags & ~(FLAGS_ATRNEW|FLAGS_WRITEERROR);
+	//find the entry again, the mount does not keep its place
+	FileInfo.vDisk = &tmpvDisk;
+	tmpvDisk.dir_cluster = vd->dir_cluster;
+	if(fatGetDirEntry(vd->file_index,0) && tmpvDisk.start_cluster == vd->start_cluster) {
+		mr.dir_sector = last_dir_sector;
+		mr.dir_index = last_dir_index;
+	}
+	tmpvDisk.dir_cluster = dir_cluster;
+	FileInfo.vDisk = actual;
+	eeprom_update_block(&mr, &mount_store[drive], sizeof(mr));
+}
+
+//mount vDisk[drive] from its record, 1 if done (the 8+3 name is in
+//atari_sector_buffer then, an ATX image needs loadAtxFile() after that)
+unsigned char mount_restore(unsigned char drive)
+{
+	virtual_disk_t *vd = &vDisk[drive];
+	struct mount_record mr;
+	struct direntry *de;
+
+	eeprom_read_block(&mr, &mount_store[drive], sizeof(mr));
+	if(mr.dir_cluster == 0xffffffff || mr.dir_sector == 0xffffffff
+	   || mr.dir_index > 15 || !(mr.flags & FLAGS_DRIVEON))
+		return 0;
+	//D1-D4: only the image SaveIm has kept, not the last one mounted
+	if(drive && (eeprom_read_dword(&image_store[drive-1].dir_cluster) != mr.dir_cluster
+	   || eeprom_read_word(&image_store[drive-1].file_index) != mr.file_index))
+		return 0;
+
+	if(mmcReadCached(mr.dir_sector))
+		return 0;	//card error, the directory walk tells more
+	de = ((struct direntry *) mmc_sector_buffer) + mr.dir_index;
+	if((u08)de->deName[0] == SLOT_EMPTY || (u08)de->deName[0] == SLOT_DELETED
+	   || ((u32) de->deHighClust<<16 | de->deStartCluster) != mr.start_cluster
+	   || de->deFileSize != mr.size)
+		return 0;	//not the same file any more
+	memcpy(atari_sector_buffer, de->deName, 11);	//name+ext
+	atari_sector_buffer[11] = 0;
+
+	FileInfo.vDisk = vd;
+	vd->dir_cluster = mr.dir_cluster;
+	vd->file_index = mr.file_index;
+	vd->start_cluster = mr.start_cluster;
+	vd->size = mr.size;
+	vd->flags = mr.flags;
+	fatMapClusterRuns();
+	return 1;
+}
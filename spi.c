@@ -121,6 +121,56 @@ u08 spiTransferFF()
 
 //#define spiTransferTwoFF()	{ spiTransferFF(); spiTransferFF(); }
 
+void spiReceiveBlock(u08 *buff, u16 len)
+{
+	// SPIF is clear here, the last transfer read SPSR and SPDR
+	asm volatile (
+		"	out	%[spdr],%[ff]"		"\n\t"	//first byte
+		"	rjmp	2f"			"\n\t"
+		"1:	in	__tmp_reg__,%[spsr]"	"\n\t"
+		"	sbrs	__tmp_reg__,%[spif]"	"\n\t"
+		"	rjmp	1b"			"\n\t"
+		"	in	__tmp_reg__,%[spdr]"	"\n\t"
+		"	out	%[spdr],%[ff]"		"\n\t"	//next byte goes out
+		"	st	%a[p]+,__tmp_reg__"	"\n\t"	//while this one is stored
+		"2:	sbiw	%[n],1"			"\n\t"
+		"	brne	1b"			"\n\t"
+		"3:	in	__tmp_reg__,%[spsr]"	"\n\t"	//last byte
+		"	sbrs	__tmp_reg__,%[spif]"	"\n\t"
+		"	rjmp	3b"			"\n\t"
+		"	in	__tmp_reg__,%[spdr]"	"\n\t"
+		"	st	%a[p],__tmp_reg__"
+		: [p] "+e" (buff), [n] "+w" (len)
+		: [ff] "r" ((u08)0xFF), [spdr] "I" (_SFR_IO_ADDR(SPDR)),
+		  [spsr] "I" (_SFR_IO_ADDR(SPSR)), [spif] "I" (SPIF)
+		: "memory");
+}
+
+void spiSendBlock(const u08 *buff, u16 len)
+{
+	u08 s;
+
+	asm volatile (
+		"	ld	__tmp_reg__,%a[p]+"	"\n\t"
+		"	out	%[spdr],__tmp_reg__"	"\n\t"	//first byte
+		"	rjmp	2f"			"\n\t"
+		"1:	ld	__tmp_reg__,%a[p]+"	"\n\t"	//next byte while the last one goes
+		"3:	in	%[s],%[spsr]"		"\n\t"
+		"	sbrs	%[s],%[spif]"		"\n\t"
+		"	rjmp	3b"			"\n\t"
+		"	out	%[spdr],__tmp_reg__"	"\n\t"
+		"2:	sbiw	%[n],1"			"\n\t"
+		"	brne	1b"			"\n\t"
+		"4:	in	%[s],%[spsr]"		"\n\t"	//last byte
+		"	sbrs	%[s],%[spif]"		"\n\t"
+		"	rjmp	4b"			"\n\t"
+		"	in	%[s],%[spdr]"			//clears SPIF
+		: [p] "+e" (buff), [n] "+w" (len), [s] "=&r" (s)
+		: [spdr] "I" (_SFR_IO_ADDR(SPDR)),
+		  [spsr] "I" (_SFR_IO_ADDR(SPSR)), [spif] "I" (SPIF)
+		: "memory");
+}
+
 /*
 void spiTransfer10xFF()
 {
@@ -63,4 +63,10 @@ u08 spiTransferByte(u08 data);
 u08 spiTransferFF();
 void spiTransferTwoFF();
 
+// spiReceiveBlock()/spiSendBlock() move the data block of a card transfer
+// (len>0).  The next byte is clocked while the last one is stored or the
+// next one fetched, no call per byte.  The destination can be any buffer.
+void spiReceiveBlock(u08 *buff, u16 len);
+void spiSendBlock(const u08 *buff, u16 len);
+
 #endif
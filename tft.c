@@ -13,6 +13,7 @@
 #include "tft.h"
 #include "fat.h"
 #include "tape.h"
+#include "dirindex.h"
 
 extern unsigned char debug;
 extern char atari_sector_buffer[];
@@ -37,6 +38,8 @@ void file_page();
 void config_page();
 void tape_page();
 unsigned int debug_page();
+void save_images();
+unsigned char sio_yield();
 
 struct display tft;
 
@@ -58,7 +61,6 @@ unsigned int action_b1_4 (struct button *b) {
 
 	if(p.x > 200) {	//file select page
 		actual_page = PAGE_FILE;
-		sei();
 		tft.pages[actual_page].draw();
 	}
 	else if(p.x < 40) {	//deactivate
@@ -74,7 +76,6 @@ unsigned int action_b1_4 (struct button *b) {
 unsigned int action_tape (struct button *b) {
 	actual_page = PAGE_FILE;
 	tape_mode = 1;
-	sei();
 	tft.pages[actual_page].draw();
 	return(0);
 }
@@ -118,6 +119,10 @@ unsigned int action_cancel () {
 	return(0);
 }
 
+unsigned int file_entry(unsigned int i) {	//entry at line i of the list
+	return(tft.cfg.sort ? dirIndexEntry(i | DIRINDEX_SORTED) : i);
+}
+
 void pretty_name(char *b) {	//insert dot in filename.ext
 	unsigned char i = 11;
 
@@ -134,10 +139,17 @@ unsigned int list_files () {
 	unsigned int col;
 	unsigned char e;
 
-	if(!nfiles)
-		while (fatGetDirEntry(nfiles,0)) nfiles++;
+	if(!nfiles) {
+		dir_scan_t s;
+		fatScanDirStart(&s, FileInfo.vDisk->dir_cluster, 1);
+		while(fatScanDirSector(&s, 0))
+			sio_yield();	//a sector at a time, a command may come in between
+		nfiles = s.entries;
+	}
+	if(tft.cfg.sort)
+		dirIndexUpdate();
 
-	if(!fatGetDirEntry(next_file_idx,0))
+	if(!fatGetDirEntry(file_entry(next_file_idx),0))
 		return(0);
 
 	set_text_pos(15,32);	//page counter
@@ -147,8 +159,9 @@ unsigned int list_files () {
 
 	set_text_pos(15,45);
 	for(i = next_file_idx; i < next_file_idx+10; i++) {
+		sio_yield();	//a command from the Atari may come in here
 		//print_I(0,45+(i*8*2),1,White,Black,i);
-		if(fatGetDirEntry(i,0)) {
+		if(fatGetDirEntry(file_entry(i),0)) {
 			if(FileInfo.Attr & ATTR_DIRECTORY)	//other color
 				col = 0x07ff;
 			else {
@@ -206,6 +219,38 @@ unsigned int list_files_last () {
 	return(0);
 }
 
+//the sorted index got ready: the file page again, sorted now
+void list_files_sorted () {
+	if(actual_page == PAGE_FILE && tft.cfg.sort && dirIndexUpdate() && next_file_idx >= 10) {
+		next_file_idx -= 10;
+		list_files();
+	}
+}
+
+unsigned int action_jump () {	//letter strip right of the buttons
+	unsigned int e = 0;
+	unsigned char i;
+	char prefix[2];
+
+	i = (p.y - 46) / 8;	// 46-262 => '#','A'-'Z'
+	if(i > 26)
+		i = 26;
+	if(i) {
+		prefix[0] = 'A' - 1 + i;
+		prefix[1] = 0;
+		if(tft.cfg.sort && dirIndexUpdate())
+			e = dirIndexLocate(prefix);
+		else
+			e = dirIndexFind(prefix, 0);
+		if(e == DIRINDEX_NOTFOUND)
+			return(0);
+	}
+	next_file_idx = e / 10 * 10;
+	file_selected = -1;
+	list_files();
+	return(0);
+}
+
 unsigned int action_select() {
 	unsigned int file;
 	unsigned char i;
@@ -217,7 +262,7 @@ unsigned int action_select() {
 	file += next_file_idx - 10;
 	//print_I(160,294,1,White,atari_bg,file);
 
-	fatGetDirEntry(file,1);
+	fatGetDirEntry(file_entry(file),1);
 	if(FileInfo.Attr & ATTR_DIRECTORY) {
 		//set new directory to current
 		FileInfo.vDisk->dir_cluster=FileInfo.vDisk->start_cluster;
@@ -269,7 +314,7 @@ was_root:	//outbox(path);
 	}
 	list_files();
 	//read file again, that we have the long name in buffer
-	fatGetDirEntry(file,1);
+	fatGetDirEntry(file_entry(file),1);
 	return(0);
 }
 
@@ -281,6 +326,8 @@ unsigned int action_ok () {
 		file_selected = 0;
 	}
 	tft.pages[actual_page].draw();
+	if(file_selected != -1 && file_selected)
+		return(file_entry(file_selected));
 	return(file_selected);
 }
 
@@ -314,16 +361,7 @@ unsigned int action_save_cfg () {
 	eeprom_update_byte(&cfg, *(char *)&tft.cfg);
 	//check for SaveIm Button
 	if(flags->selected) {
-		//map D1-D4 0-indexed
-		for(i = 0; i < DEVICESNUM-1; i++) {
-			if(vDisk[i+1].flags & FLAGS_DRIVEON) {
-				eeprom_update_dword(&image_store[i].dir_cluster, vDisk[i+1].dir_cluster);
-				eeprom_update_word(&image_store[i].file_index, vDisk[i+1].file_index);
-			}
-			else {
-				eeprom_update_dword(&image_store[i].dir_cluster, 0xffffffff);
-			}
-		}
+		save_images();
 	}
 	if(rot != tft.cfg.rot) {	//rotation has changed? Then...
 		eeprom_update_word(&MINX, 0xffff);	//force new calibration
@@ -417,53 +455,81 @@ unsigned int press () {	//for buttons with no action here
 	return(0);
 }
 
+//the names of the buttons, those of the drive buttons are in RAM
+const char b_tape[] PROGMEM = "Tape:";
+const char b_new[] PROGMEM = "New";
+const char b_cfg[] PROGMEM = "Cfg";
+const char b_outbox[] PROGMEM = "Outbox";
+const char b_top[] PROGMEM = "Top";
+const char b_prev[] PROGMEM = "Prev";
+const char b_ok[] PROGMEM = "OK";
+const char b_exit[] PROGMEM = "Exit";
+const char b_next[] PROGMEM = "Next";
+const char b_last[] PROGMEM = "Last";
+const char b_file[] PROGMEM = "File";
+const char b_jump[] PROGMEM = "Jump";
+const char b_rotate[] PROGMEM = "Rotate";
+const char b_scroll[] PROGMEM = "Scroll";
+const char b_bootd1[] PROGMEM = "BootD1";
+const char b_1050[] PROGMEM = "1050";
+const char b_blank[] PROGMEM = "Blank";
+const char b_sort[] PROGMEM = "Sort";
+const char b_saveim[] PROGMEM = "SaveIm";
+const char b_save[] PROGMEM = "Save";
+const char b_start[] PROGMEM = "Start";
+const char b_pause[] PROGMEM = "Pause";
+const char b_turbo[] PROGMEM = "Turbo";
+const char b_back[] PROGMEM = "Back";
+
 const struct button PROGMEM buttons_main[] = {
 	//name, x, y, width, heigth, fg-col, bg-col, font-col, type, act, sel
-	{"D0:",10,200,50,30,Grey,Black,Black,&(struct b_flags){ROUND,1,1},action_b0},
+	{"D0:",10,200,50,30,Grey,Black,Black,&(struct b_flags){ROUND,1,1,1},action_b0},
 	//D1:FILENAME.ATR must fit!
-	{"D1:<empty>     ",10,40,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_b1_4},
-	{"D2:<empty>     ",10,80,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_b1_4},
-	{"D3:<empty>     ",10,120,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_b1_4},
-	{"D4:<empty>     ",10,160,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_b1_4},
-	{"Tape:",80,200,80,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_tape},
-	{"New",240-61,200,50,30,Grey,Black,Green,&(struct b_flags){ROUND,1,0},press},
-	{"Cfg",240-61,240,50,30,Grey,Black,Blue,&(struct b_flags){ROUND,1,0},action_cfg},
-	{"Outbox",10,280,240-11,320-1,0,0,0,&(struct b_flags){0,0,0},debug_page}
+	{"D1:<empty>     ",10,40,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0,1},action_b1_4},
+	{"D2:<empty>     ",10,80,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0,1},action_b1_4},
+	{"D3:<empty>     ",10,120,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0,1},action_b1_4},
+	{"D4:<empty>     ",10,160,240-21,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0,1},action_b1_4},
+	{b_tape,80,200,80,30,Grey,Black,Black,&(struct b_flags){ROUND,1,0},action_tape},
+	{b_new,240-61,200,50,30,Grey,Black,Green,&(struct b_flags){ROUND,1,0},press},
+	{b_cfg,240-61,240,50,30,Grey,Black,Blue,&(struct b_flags){ROUND,1,0},action_cfg},
+	{b_outbox,10,280,240-11,320-1,0,0,0,&(struct b_flags){0,0,0},debug_page}
 };
 
 const struct button PROGMEM buttons_file[] = {
-	{"Top",164,45,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_top},
-	{"Prev",164,85,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_rev},
-	{"OK",164,125,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_ok},
-	{"Exit",164,165,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel},
-	{"Next",164,205,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files},
-	{"Last",164,245,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_last},
-	{"File",15,45,150,240,Grey,Black,White,&(struct b_flags){ROUND,0,0},action_select}
+	{b_top,164,45,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_top},
+	{b_prev,164,85,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_rev},
+	{b_ok,164,125,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_ok},
+	{b_exit,164,165,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel},
+	{b_next,164,205,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files},
+	{b_last,164,245,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},list_files_last},
+	{b_file,15,45,150,240,Grey,Black,White,&(struct b_flags){ROUND,0,0},action_select},
+	{b_jump,226,45,14,219,Grey,Black,White,&(struct b_flags){ROUND,0,0},action_jump}
 };
 
 //keep the order analog to struct tft.cfg, otherwise read/write function
 //wouldn't work correctly!!!
 const struct button PROGMEM buttons_cfg[] = {
-	{"Rotate",15,45,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
-	{"Scroll",15,85,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
-	{"BootD1",15,125,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
-	{"1050",15,165,70,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
-	{"Blank",15,205,80,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_rotate,15,45,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_scroll,15,85,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_bootd1,15,125,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_1050,15,165,70,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_blank,15,205,80,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_sort,164,45,60,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
 	//!!leave this buttons at the end, then we can loop thru the previous!!
-	{"SaveIm",15,245,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
-	{"Save",164,125,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_save_cfg},
-	{"Exit",164,165,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel}
+	{b_saveim,15,245,90,30,Grey,Black,Light_Blue,&(struct b_flags){ROUND,1,0},action_change},
+	{b_save,164,125,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_save_cfg},
+	{b_exit,164,165,60,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel}
 };
 
 const struct button PROGMEM buttons_tape[] = {
-	{"Start",15,165,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},press},
-	{"Pause",15,205,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_tape_pause},
-	{"Turbo",144,165,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_tape_turbo},
-	{"Exit",144,205,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel}
+	{b_start,15,165,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},press},
+	{b_pause,15,205,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_tape_pause},
+	{b_turbo,144,165,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_tape_turbo},
+	{b_exit,144,205,80,30,Grey,Black,White,&(struct b_flags){ROUND,1,0},action_cancel}
 };
 
 const struct button PROGMEM buttons_debug[] = {
-	{"Back",0,0,240,280,Grey,Black,White,&(struct b_flags){ROUND,0,0},action_cancel}
+	{b_back,0,0,240,280,Grey,Black,White,&(struct b_flags){ROUND,0,0},action_cancel}
 };
 
 struct page pages[] = {
@@ -476,40 +542,51 @@ struct page pages[] = {
 
 struct display tft = {240, 320, {PORTRAIT_2, 0}, pages};
 
-void draw_Buttons () {
-	struct button b,*bp;
-	unsigned char i,j;
+//the button copy lives only here, not while draw_Buttons() lets a command in
+void draw_Button (struct button *bp) {
+	struct button b;
+	unsigned char j;
 
-	for(i = 0; i < tft.pages[actual_page].nbuttons; i++) {
-		bp = &tft.pages[actual_page].buttons[i];
-		//read the whole button data from pgm to struct
-		for(j = 0; j < sizeof(struct button); j++) {
-			*((char*)&b+j) = pgm_read_byte((char*)bp+j);
-		}
-		if(!b.flags->active)
-			continue;
-		if(b.flags->selected) {
-			b.fg = Blue;
-			b.fc = Yellow;
-		}
-		Draw_Rectangle(b.x,b.y,b.x+b.width,b.y+b.heigth,1,b.flags->type,b.fg,b.bg);
-
-/*		//3D Effekt Test
-		print_I(120,262,1,White,atari_bg,b.fg);
-		print_I(150,262,1,White,atari_bg,b.fg>>1);
-		Draw_H_Line(b.x,b.x+b.width,b.y+b.heigth,b.fg>>1);
-		Draw_V_Line(b.x+b.width,b.y,b.y+b.heigth,b.fg>>1);
-		Draw_H_Line(b.x+1,b.x+b.width+1,b.y+b.heigth+1,b.fg>>1);
-		Draw_V_Line(b.x+b.width+1,b.y+1,b.y+b.heigth+1,b.fg>>1);
+	//read the whole button data from pgm to struct
+	for(j = 0; j < sizeof(struct button); j++) {
+		*((char*)&b+j) = pgm_read_byte((char*)bp+j);
+	}
+	if(!b.flags->active)
+		return;
+	if(b.flags->selected) {
+		b.fg = Blue;
+		b.fc = Yellow;
+	}
+	Draw_Rectangle(b.x,b.y,b.x+b.width,b.y+b.heigth,1,b.flags->type,b.fg,b.bg);
+
+/*	//3D Effekt Test
+	print_I(120,262,1,White,atari_bg,b.fg);
+	print_I(150,262,1,White,atari_bg,b.fg>>1);
+	Draw_H_Line(b.x,b.x+b.width,b.y+b.heigth,b.fg>>1);
+	Draw_V_Line(b.x+b.width,b.y,b.y+b.heigth,b.fg>>1);
+	Draw_H_Line(b.x+1,b.x+b.width+1,b.y+b.heigth+1,b.fg>>1);
+	Draw_V_Line(b.x+b.width+1,b.y+1,b.y+b.heigth+1,b.fg>>1);
 */
-		print_str(b.x+10,b.y+b.heigth/2-6,2,b.fc,b.fg,b.name);
+	if(!b.flags->ram) {
+		print_str_P(b.x+10,b.y+b.heigth/2-6,2,b.fc,b.fg,b.name);
+		return;
+	}
+	print_str(b.x+10,b.y+b.heigth/2-6,2,b.fc,b.fg,(char*)b.name);
 
-		//Logos
-		if(b.name[0] == 'D' && b.name[1] != '0') {
-			Draw_BMP(b.x+b.width-18,b.y+8,b.x+b.width-2,b.y+8+16,disk_image);
-			if(b.name[3] == '<')
-				Draw_Line(b.x+b.width-18,b.y+8,b.x+b.width-2,b.y+8+16,Red);
-		}
+	//Logos
+	if(b.name[1] != '0') {
+		Draw_BMP(b.x+b.width-18,b.y+8,b.x+b.width-2,b.y+8+16,disk_image);
+		if(b.name[3] == '<')
+			Draw_Line(b.x+b.width-18,b.y+8,b.x+b.width-2,b.y+8+16,Red);
+	}
+}
+
+void draw_Buttons () {
+	unsigned char i;
+
+	for(i = 0; i < tft.pages[actual_page].nbuttons; i++) {
+		sio_yield();
+		draw_Button(&tft.pages[actual_page].buttons[i]);
 	}
 }
 
@@ -597,6 +674,11 @@ void file_page () {
 	Draw_Rectangle(11,41,tft.width-12,279,0,SQUARE,Grey,Black);
 	//Draw_Rectangle(12,42,tft.width-13,278,0,SQUARE,Grey,Black);
 	draw_Buttons();
+	{
+		unsigned char i;
+		for(i = 0; i < 27; i++)
+			print_char(232,46+i*8,1,Grey,Black,i ? 'A'-1+i : '#');
+	}
 	file_selected = -1;
 	list_files();
 }
@@ -650,6 +732,7 @@ void tft_Setup() {
 	unsigned int id;
 
 	TFT_init();
+	touchInit();
 	*(char *)&tft.cfg = eeprom_read_byte(&cfg);
 	TFT_set_rotation(tft.cfg.rot);
 	id = TFT_getID();
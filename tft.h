@@ -8,10 +8,11 @@ struct b_flags {
 	char type : 1;		//ROUND, SQUARE
 	char active : 1;
 	char selected : 1;
+	char ram : 1;		//name in RAM (the drive buttons change it), else in flash
 };
 
 struct button {
-	char *name;
+	const char *name;
 	unsigned int x;
 	unsigned int y;
 	unsigned int width;
@@ -42,6 +43,7 @@ struct display {
 		unsigned char boot_d1 : 1;
 		unsigned char drive_type : 1;
 		unsigned char blank : 1;
+		unsigned char sort : 1;
 	} cfg;
 	struct page *pages;
 	//struct TSPoint *tp;	//unused
@@ -52,10 +54,22 @@ struct file_save {
 	u16 file_index;
 };
 
+struct mount_record {		//mount_store[drive], see mount.c
+	u32 dir_cluster;
+	u16 file_index;
+	u32 dir_sector;		//directory entry of the image: SD sector,
+	u08 dir_index;		// entry in it (0xffffffff: no record)
+	u32 start_cluster;	//the entry has to match
+	u32 size;
+	u08 flags;		//vDisk flags of the mount
+};
+
 //functions for external use
 void pretty_name(char *b);
 
+void draw_Button (struct button *bp);
 void draw_Buttons ();
+void list_files_sorted ();
 
 void outbox_P(const char *);
 void outbox(char *);
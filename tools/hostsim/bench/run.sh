@@ -0,0 +1,39 @@
+#!/bin/sh
+# run.sh - the SIO benchmark: every script on a contiguous and on a
+# fragmented card, sort.scr on a card with a big directory, one CSV on
+# stdout (see ../README)
+#
+#	bench/run.sh [sdrive-sim options]
+
+B=$(cd "$(dirname "$0")" && pwd)
+SIM=$B/..
+FW=$SIM/../..
+W=$(mktemp -d)
+trap 'rm -rf "$W"' EXIT
+cd "$W" || exit 1
+
+cp "$FW/sdrive-ctrl/sdrive.atr" SDRIVE.ATR
+cp "$FW/sdrive-ctrl/sdrive.atr" DOS.ATR
+cp "$FW/sdrive-ctrl/sdrive-noboot.atr" BLANK.ATR
+cat "$FW"/sdrive-ctrl/disk/*.com > SDRIVE.XEX
+"$SIM/mkatx" DOS.ATR PROT.ATX || exit 1
+FILES="SDRIVE.ATR DOS.ATR BLANK.ATR SDRIVE.XEX PROT.ATX"
+"$SIM/mkfatimg" -n 40 contig.img $FILES || exit 1
+"$SIM/mkfatimg" -F 1 -n 40 frag.img $FILES || exit 1
+head -c 65536 /dev/zero > SDRIVE.IDX
+"$SIM/mkfatimg" -n 480 index.img $FILES SDRIVE.IDX || exit 1
+
+head=1
+for card in contig frag; do
+	for s in boot dos xex atx format restore; do
+		cp $card.img run.img
+		"$SIM/sdrive-sim" -f csv "$@" run.img "$B/$s.scr" > out.csv || exit 1
+		if [ $head = 1 ]; then
+			sed -n '1s/^/card,/p' out.csv
+			head=0
+		fi
+		sed -e '1d' -e "s|^$B/||" -e "s|^|$card,|" out.csv
+	done
+done
+"$SIM/sdrive-sim" -f csv "$@" index.img "$B/sort.scr" > out.csv || exit 1
+sed -e '1d' -e "s|^$B/||" -e "s|^|index,|" out.csv
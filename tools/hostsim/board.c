@@ -0,0 +1,129 @@
+/* board.c - SDrive host simulation: display, touchscreen and ATX timing
+ *
+ * The TFT and the touchscreen are not simulated: drawing is dropped, text
+ * printed through outbox() goes to stderr with -v, and the panel is never
+ * touched.  atx_avr.c is replaced by versions of its hooks that read the
+ * virtual timer 1.
+ */
+
+#include <stdio.h>
+#include <avr/io.h>
+#include "avrlibtypes.h"
+#include "display.h"
+#include "touchscreen.h"
+#include "atx.h"
+#include "tft.h"
+#include "hostsim.h"
+
+extern struct display tft;
+extern int sim_verbose;
+
+unsigned int MAX_X = X_max;
+unsigned int MAX_Y = Y_max;
+
+/* a calibrated panel, so tft_Setup() does not ask for calibration */
+u16 MINX = 150, MINY = 120, MAXX = 920, MAXY = 940;
+
+static void print(const char *ch)
+{
+	if (sim_verbose)
+		fprintf(stderr, "[tft] %s\n", ch);
+}
+
+void print_str(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, char *ch) { print(ch); }
+void print_str_P(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, const char *ch) { print(ch); }
+void print_strn(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, char *ch, unsigned char n) { }
+void print_ln_P(unsigned char font_size, unsigned int colour, unsigned int back_colour, const char *ch) { print(ch); }
+void print_ln(unsigned char font_size, unsigned int colour, unsigned int back_colour, char *ch) { print(ch); }
+void TFT_init(void) { }
+void TFT_on(void) { }
+void TFT_off(void) { }
+void TFT_sleep_on(void) { }
+void TFT_sleep_off(void) { }
+void TFT_GPIO_init(void) { }
+void TFT_reset(void) { }
+void TFT_write_bus(unsigned char value) { }
+void TFT_write_cmd(unsigned char value) { }
+void TFT_write_data(unsigned int value) { }
+void TFT_write(unsigned char value) { }
+void TFT_write_REG_DATA(unsigned char reg, unsigned char data_value) { }
+unsigned int TFT_getID(void) { return 0; }
+void TFT_set_rotation(unsigned char value) { }
+void TFT_set_display_window(unsigned int x_pos1, unsigned int y_pos1, unsigned int x_pos2, unsigned int y_pos2) { }
+void TFT_scroll_init(unsigned int tfa, unsigned int vsa, unsigned int bfa) { }
+void TFT_scroll(unsigned int scroll) { }
+void TFT_fill(unsigned int colour) { }
+void TFT_fill_area(signed int x1, signed int y1, signed int x2, signed int y2, unsigned int colour) { }
+unsigned char (*TFT_yield)();
+unsigned int TFT_BGR2RGB(unsigned int colour) { return 0; }
+unsigned int RGB565_converter(unsigned char r, unsigned char g, unsigned char b) { return 0; }
+void swap(signed int *a, signed int *b) { }
+void Draw_Pixel(unsigned int x_pos, unsigned int y_pos, unsigned int colour) { }
+void Draw_Point(unsigned int x_pos, unsigned int y_pos, unsigned char pen_width, unsigned int colour) { }
+void Draw_Line(signed int x1, signed int y1, signed int x2, signed int y2, unsigned int colour) { }
+void Draw_V_Line(signed int x1, signed int y1, signed int y2, unsigned colour) { }
+void Draw_H_Line(signed int x1, signed int x2, signed int y1, unsigned colour) { }
+void Draw_Triangle(signed int x1, signed int y1, signed int x2, signed int y2, signed int x3, signed int y3, unsigned char fill, unsigned int colour) { }
+void Draw_Rectangle(signed int x1, signed int y1, signed int x2, signed int y2, unsigned char fill, unsigned char type, unsigned int colour, unsigned int back_colour) { }
+void Draw_H_Bar(signed int x1, signed int x2, signed int y1, signed int bar_width, signed int bar_value, unsigned int border_colour, unsigned int bar_colour, unsigned int back_colour, unsigned char border) { }
+void Draw_V_Bar(signed int x1, signed int y1, signed int y2, signed int bar_width, signed int bar_value, unsigned int border_colour, unsigned int bar_colour, unsigned int back_colour, unsigned char border) { }
+void Draw_Circle(signed int xc, signed int yc, signed int radius, unsigned char fill, unsigned int colour) { }
+void Draw_Font_Pixel(unsigned int x_pos, unsigned int y_pos, unsigned int colour, unsigned char pixel_size) { }
+void print_char(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, unsigned char ch) { }
+void set_text_pos(unsigned int x, unsigned int y) { }
+void print_C(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, signed int value) { }
+void print_I(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, signed int value) { }
+void print_D(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, unsigned int value, unsigned char points) { }
+void print_F(unsigned int x_pos, unsigned int y_pos, unsigned char font_size, unsigned int colour, unsigned int back_colour, float value, unsigned char points) { }
+void Draw_BMP(signed int x_pos1, signed int y_pos1, signed int x_pos2, signed int y_pos2, const char * bitmap) { }
+
+void restorePorts(void) { }
+void waitTouch(void) { }
+void touchInit(void) { }
+char touchPoll(void) { return 0; }
+void touchAbort(void) { }
+char isTouching(void) { return 0; }
+struct TSPoint getPoint(void) { struct TSPoint p = { 0, 0 }; return p; }
+struct TSPoint getRawPoint(void) { struct TSPoint p = { 0, 0 }; return p; }
+
+void waitForAngularPosition(u16 pos)
+{
+	u16 now = getCurrentHeadPosition();
+	u32 ticks;
+
+	if (!(TCCR1B & 7))	// timer stopped, the head would never get there
+		return;
+	if (pos < now)		// wait for the rollover first
+		ticks = (u32)OCR1A + 1 - 2 * (u32)now + 2 * (u32)pos;
+	else
+		ticks = 2 * (u32)(pos - now);
+	sim_advance((uint64_t)ticks * 64, PH_DELAY);
+}
+
+void waitForAngularDelay(u16 start, u32 delay)
+{
+	u16 now = getCurrentHeadPosition();
+	u32 elapsed;
+
+	if (!(TCCR1B & 7))	// timer stopped, the head would never get there
+		return;
+	elapsed = now >= start ? now - start : AU_FULL_ROTATION + 1 - start + now;
+	if (elapsed < delay)
+		sim_advance((uint64_t)(delay - elapsed) * 2 * 64, PH_DELAY);
+}
+
+u16 getCurrentHeadPosition(void)
+{
+	return TCNT1 / 2;
+}
+
+void byteSwapAtxFileHeader(struct atxFileHeader *header) { }
+void byteSwapAtxTrackHeader(struct atxTrackHeader *header) { }
+void byteSwapAtxSectorListHeader(struct atxSectorListHeader *header) { }
+void byteSwapAtxSectorHeader(struct atxSectorHeader *header) { }
+void byteSwapAtxTrackChunk(struct atxTrackChunk *header) { }
+
+u08 is_1050(void)
+{
+	return tft.cfg.drive_type;
+}
@@ -0,0 +1,97 @@
+/* hostsim.h - SDrive host simulation: virtual clock, devices and cost model.
+ *
+ * The firmware sources are compiled unchanged for the host.  Only the
+ * hardware facing parts are replaced:
+ *	spi.c		-> sdcard.c	(SPI master + SD card in SPI mode, backed by an image file)
+ *	usart.c regs	-> sio.c	(USART0 registers + the Atari side of the SIO bus)
+ *	atx_avr.c	-> board.c	(angular position from the virtual timer 1)
+ *	display.c,
+ *	touchscreen.c	-> board.c	(stubs)
+ *
+ * Time only advances where the hardware would make the AVR wait: SPI
+ * transfers, USART polling, _delay_us()/_delay_ms() and the card latencies
+ * below.  Code in between is free, so the numbers are "cycle-approximate":
+ * good for comparing I/O patterns, not for counting instructions.
+ */
+#ifndef HOSTSIM_H
+#define HOSTSIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define HOSTSIM_US(us)		((uint64_t)((us) * (F_CPU / 1000000.0)))
+
+/* cost model */
+#define SIM_SPI_CALL_CYCLES	14	// call/ret and SPIF polling around one spiTransferByte()
+#define SIM_SPI_BLOCK_CYCLES	4	// SPIF polling per byte of spiReceiveBlock()/spiSendBlock()
+#define SIM_USART_POLL_CYCLES	12	// one turn of a UCSR0A/PINC polling loop
+#define SIM_CKSUM_CYCLES	8	// one byte of the add/adc loop in get_checksum()
+
+/* SD card timing (typical class 4-10 card, 16 MHz, SPI at F_CPU/2) */
+#define SIM_SD_READ_LATENCY_US	100	// CMD17/CMD18 first data token
+#define SIM_SD_STREAM_GAP_US	8	// CMD18, token of each following block
+#define SIM_SD_WRITE_BUSY_US	750	// CMD24 programming
+#define SIM_SD_MWRITE_BUSY_US	250	// CMD25, each block
+#define SIM_SD_ERASED_BUSY_US	120	// CMD25 block inside an ACMD23 pre-erased range
+#define SIM_SD_STOP_BUSY_US	300	// CMD25 stop token
+#define SIM_SD_CMD12_BUSY_US	4	// CMD12 after a read stream
+
+/* SIO bus timing seen from the Atari */
+#define SIM_SIO_T0_US		750	// command line low -> first frame byte
+#define SIM_SIO_T1_US		850	// last frame byte -> command line high
+#define SIM_SIO_T3_US		1000	// ACK -> data frame (write commands)
+
+enum sim_phase {
+	PH_CPU,		// firmware waits not caused by a device (none yet)
+	PH_RX,		// waiting for command/data frame bytes
+	PH_SD,		// SPI traffic and card latency on data/dir sectors
+	PH_FAT,		// the same for FAT sectors
+	PH_CKSUM,	// get_checksum() over a buffer (frames are summed on the fly)
+	PH_TX,		// waiting for the transmitter
+	PH_DELAY,	// protocol delays (_delay_us/_delay_ms) and ATX rotation
+	PH_MAX
+};
+
+extern const char *const sim_phase_name[PH_MAX];
+
+/* virtual clock */
+extern uint64_t sim_now;
+extern uint64_t sim_phase_cycles[PH_MAX];
+void sim_advance(uint64_t cycles, enum sim_phase ph);
+void sim_sync(void);
+void sim_run_idle(uint64_t cycles);
+
+/* SD card */
+struct sd_stats {
+	uint64_t spi_bytes;
+	uint64_t commands;
+	uint64_t cmd_count[64];
+	uint64_t blocks_read;
+	uint64_t blocks_written;
+	uint64_t busy_violations;	// command sent while the card was still programming
+};
+extern struct sd_stats sd_stats;
+int sd_open(const char *path, int sdhc);
+void sd_close(void);
+void sd_set_fat_range(uint32_t first, uint32_t count);
+
+/* SIO bus (Atari side) */
+struct sio_result {
+	uint64_t start;			// command line asserted
+	uint64_t end;			// last byte from the drive left the wire
+	uint8_t rx[1024];		// everything the drive sent
+	uint16_t rx_len;
+	uint8_t rx_overflow;
+};
+void sio_reset(void);
+void sio_begin_command(uint8_t dev, uint8_t cmd, uint8_t aux1, uint8_t aux2,
+		       const uint8_t *data, uint16_t data_len);
+void sio_finish(struct sio_result *r);
+uint32_t sio_baud(void);
+
+/* firmware entry points used by the driver */
+void sdrive_main(void);
+void process_command(void);
+void PCINT1_vect(void);
+
+#endif
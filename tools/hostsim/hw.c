@@ -0,0 +1,153 @@
+/* hw.c - SDrive host simulation: registers, virtual clock and timer 1 */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include "hostsim.h"
+
+volatile uint8_t DDRB, PORTB, PINB, DDRC, PORTC, DDRD, PORTD, PIND;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2A, TCCR2B, TIMSK2, TIFR2, TCNT2, OCR2A;
+volatile uint8_t TCCR0A, TCCR0B, TIMSK0, TIFR0, TCNT0, OCR0A;
+volatile uint8_t GTCCR, PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t ACSR, DIDR0, ADCSRA, ADCSRB, ADMUX;
+volatile uint16_t ADC;
+volatile uint8_t SMCR, MCUCR, SPL, SPH, GPIOR0;
+volatile uint8_t UCSR0B, UCSR0C;
+volatile uint16_t UBRR0;
+volatile uint8_t SREG;
+
+/* the rest of the EEPROM: hw.o links after the firmware, so this is the
+ * end of the EEMEM section, erased */
+uint8_t hostsim_eeprom_tail[256] EEMEM = { [0 ... 255] = 0xFF };
+
+const char *const sim_phase_name[PH_MAX] = {
+	"cpu", "rx", "sd", "fat", "cksum", "tx", "delay"
+};
+
+uint64_t sim_now;
+uint64_t sim_phase_cycles[PH_MAX];
+
+/* timer 1 runs while a clock source is selected in TCCR1B */
+static uint64_t t1_start;
+static uint8_t t1_running;
+static uint64_t t1_last_match;
+
+void sio_sync(void);
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+void USART_TX_vect(void) __attribute__((weak));
+
+static uint16_t t1_prescale(void)
+{
+	switch (TCCR1B & 7) {
+	case 1: return 1;
+	case 2: return 8;
+	case 3: return 64;
+	case 4: return 256;
+	case 5: return 1024;
+	}
+	return 0;
+}
+
+static void t1_sync(void)
+{
+	uint16_t ps = t1_prescale();
+
+	if (ps && !t1_running) {
+		t1_running = 1;
+		t1_start = sim_now;
+		t1_last_match = sim_now;
+	}
+	else if (!ps)
+		t1_running = 0;
+}
+
+uint16_t hostsim_tcnt1(void)
+{
+	uint64_t ticks;
+
+	sim_sync();
+	if (!t1_running)
+		return 0;
+	ticks = (sim_now - t1_start) / t1_prescale();
+	return ticks % ((uint32_t)OCR1A + 1);
+}
+
+static void run_isr(void (*isr)(void))
+{
+	SREG &= ~_BV(SREG_I);	// hardware clears I on entry...
+	isr();
+	SREG |= _BV(SREG_I);	// ...and reti sets it again
+}
+
+/* deliver pending interrupts; called whenever the firmware touches the
+ * simulated hardware, so a polling loop with I set behaves as on the AVR */
+void sim_sync(void)
+{
+	static uint8_t in_sync;
+
+	if (in_sync)
+		return;
+	in_sync = 1;
+	t1_sync();
+	sio_sync();
+	if (SREG & _BV(SREG_I)) {
+		if (t1_running && (TIMSK1 & _BV(OCIE1A)) && TIMER1_COMPA_vect) {
+			uint64_t period = ((uint64_t)OCR1A + 1) * t1_prescale();
+			while (sim_now - t1_last_match >= period) {
+				t1_last_match += period;
+				run_isr(TIMER1_COMPA_vect);
+				t1_sync();
+				if (!t1_running)
+					break;
+			}
+		}
+		if ((UCSR0B & _BV(UDRIE0)) && USART_UDRE_vect) {
+			// UDRE is level triggered: keep serving while the buffer is free
+			uint16_t n = 0;
+			while ((UCSR0B & _BV(UDRIE0)) && (UCSR0A & _BV(UDRE0)) && n++ < 2) {
+				run_isr(USART_UDRE_vect);
+				sio_sync();
+			}
+		}
+	}
+	in_sync = 0;
+}
+
+void sim_advance(uint64_t cycles, enum sim_phase ph)
+{
+	sim_now += cycles;
+	sim_phase_cycles[ph] += cycles;
+	sim_sync();
+}
+
+/* let the main loop idle with interrupts enabled */
+void sim_run_idle(uint64_t cycles)
+{
+	uint64_t end = sim_now + cycles;
+	uint8_t sreg = SREG;
+
+	SREG |= _BV(SREG_I);
+	while (sim_now < end) {
+		uint64_t step = end - sim_now;
+		if (step > HOSTSIM_US(10))
+			step = HOSTSIM_US(10);
+		sim_now += step;
+		sim_sync();
+	}
+	SREG = sreg;
+}
+
+void hostsim_sei(void)
+{
+	SREG |= _BV(SREG_I);
+	sim_sync();
+}
+
+void hostsim_delay_us(double us)
+{
+	sim_advance(HOSTSIM_US(us), PH_DELAY);
+}
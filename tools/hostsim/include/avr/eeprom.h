@@ -0,0 +1,30 @@
+/* avr/eeprom.h replacement for the SDrive host simulation.
+ * EEMEM variables are ordinary RAM, initialised like a freshly
+ * programmed .eep image.  They are kept together in one section like on
+ * the avr, so a read past the end of one (the XEX loader's second sector
+ * does that) sees the next EEMEM variable or the erased end of the EEPROM
+ * in hw.c, not whatever RAM the host linker put there.
+ */
+#ifndef HOSTSIM_AVR_EEPROM_H
+#define HOSTSIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM	__attribute__((section("hostsim_eeprom")))
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p) { return *p; }
+static inline uint16_t eeprom_read_word(const uint16_t *p) { return *p; }
+static inline uint32_t eeprom_read_dword(const uint32_t *p) { return *p; }
+static inline void eeprom_read_block(void *dst, const void *src, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_write_byte(uint8_t *p, uint8_t v) { *p = v; }
+static inline void eeprom_write_word(uint16_t *p, uint16_t v) { *p = v; }
+static inline void eeprom_write_dword(uint32_t *p, uint32_t v) { *p = v; }
+static inline void eeprom_write_block(const void *src, void *dst, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_update_byte(uint8_t *p, uint8_t v) { *p = v; }
+static inline void eeprom_update_word(uint16_t *p, uint16_t v) { *p = v; }
+static inline void eeprom_update_dword(uint32_t *p, uint32_t v) { *p = v; }
+static inline void eeprom_update_block(const void *src, void *dst, size_t n) { memcpy(dst, src, n); }
+#define eeprom_busy_wait()	do { } while (0)
+
+#endif
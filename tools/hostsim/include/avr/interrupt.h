@@ -0,0 +1,15 @@
+/* avr/interrupt.h replacement for the SDrive host simulation.
+ * Interrupt vectors become plain functions; the simulation calls them
+ * when the corresponding event happens and the I flag is set.
+ */
+#ifndef HOSTSIM_AVR_INTERRUPT_H
+#define HOSTSIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector)	void vector(void) { }
+#define ISR_NOBLOCK
+#define ISR_BLOCK
+
+#endif
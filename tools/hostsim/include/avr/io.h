@@ -0,0 +1,140 @@
+/* avr/io.h replacement for the SDrive host simulation.
+ *
+ * Plain registers are ordinary variables (see hw.c).  Registers whose value
+ * depends on time or on an external device are routed through accessor
+ * functions of the simulation, so the firmware polling loops see the
+ * USART, the command line and timer 1 change as virtual time goes by.
+ */
+#ifndef HOSTSIM_AVR_IO_H
+#define HOSTSIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit)		(1 << (bit))
+#define bit_is_set(sfr, bit)	((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)	(!((sfr) & _BV(bit)))
+
+#define HOSTSIM_REG8(n)		extern volatile uint8_t n;
+#define HOSTSIM_REG16(n)	extern volatile uint16_t n;
+
+HOSTSIM_REG8(DDRB) HOSTSIM_REG8(PORTB) HOSTSIM_REG8(PINB)
+HOSTSIM_REG8(DDRC) HOSTSIM_REG8(PORTC)
+HOSTSIM_REG8(DDRD) HOSTSIM_REG8(PORTD) HOSTSIM_REG8(PIND)
+HOSTSIM_REG8(SPCR) HOSTSIM_REG8(SPSR) HOSTSIM_REG8(SPDR)
+HOSTSIM_REG8(TCCR1A) HOSTSIM_REG8(TCCR1B) HOSTSIM_REG8(TCCR1C) HOSTSIM_REG8(TIMSK1) HOSTSIM_REG8(TIFR1)
+HOSTSIM_REG16(OCR1A) HOSTSIM_REG16(OCR1B) HOSTSIM_REG16(ICR1)
+HOSTSIM_REG8(TCCR2A) HOSTSIM_REG8(TCCR2B) HOSTSIM_REG8(TIMSK2) HOSTSIM_REG8(TIFR2) HOSTSIM_REG8(TCNT2) HOSTSIM_REG8(OCR2A)
+HOSTSIM_REG8(TCCR0A) HOSTSIM_REG8(TCCR0B) HOSTSIM_REG8(TIMSK0) HOSTSIM_REG8(TIFR0) HOSTSIM_REG8(TCNT0) HOSTSIM_REG8(OCR0A)
+HOSTSIM_REG8(GTCCR) HOSTSIM_REG8(PCICR) HOSTSIM_REG8(PCIFR) HOSTSIM_REG8(PCMSK0) HOSTSIM_REG8(PCMSK1) HOSTSIM_REG8(PCMSK2)
+HOSTSIM_REG8(ACSR) HOSTSIM_REG8(DIDR0) HOSTSIM_REG8(ADCSRA) HOSTSIM_REG8(ADCSRB) HOSTSIM_REG8(ADMUX) HOSTSIM_REG16(ADC)
+HOSTSIM_REG8(SMCR) HOSTSIM_REG8(MCUCR) HOSTSIM_REG8(SPL) HOSTSIM_REG8(SPH) HOSTSIM_REG8(GPIOR0)
+HOSTSIM_REG8(UCSR0B) HOSTSIM_REG8(UCSR0C) HOSTSIM_REG16(UBRR0)
+HOSTSIM_REG8(SREG)
+
+/* time or device dependent registers */
+volatile uint8_t *hostsim_pinc(void);
+volatile uint8_t *hostsim_ucsr0a(void);
+volatile uint16_t *hostsim_udr0(void);
+uint16_t hostsim_tcnt1(void);
+void hostsim_sei(void);
+
+#define PINC		(*hostsim_pinc())
+#define UCSR0A		(*hostsim_ucsr0a())
+#define UDR0		(*hostsim_udr0())
+#define TCNT1		(hostsim_tcnt1())
+
+/* avrlibdefs.h would fall back to the avr "sei"/"cli" instructions */
+#define sei()		hostsim_sei()
+#define cli()		(SREG &= ~_BV(SREG_I))
+
+#define SREG_I	7
+
+#define PB0	0
+#define PB1	1
+#define PB2	2
+#define PB3	3
+#define PB4	4
+#define PB5	5
+#define PC0	0
+#define PC1	1
+#define PC2	2
+#define PC3	3
+#define PC4	4
+#define PC5	5
+#define PINC5	5
+#define PD6	6
+#define PD7	7
+
+#define SPR0	0
+#define SPR1	1
+#define CPHA	2
+#define CPOL	3
+#define MSTR	4
+#define DORD	5
+#define SPE	6
+#define SPIE	7
+#define SPI2X	0
+#define SPIF	7
+
+#define TOV1	0
+#define OCF1A	1
+#define OCF1B	2
+#define ICF1	5
+#define TOIE1	0
+#define OCIE1A	1
+#define OCIE1B	2
+#define ICIE1	5
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define WGM13	4
+#define TOIE2	0
+#define OCIE2A	1
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define WGM21	1
+#define PSRSYNC	0
+
+#define PCIE0	0
+#define PCIE1	1
+#define PCIE2	2
+#define PCIF1	1
+#define PCINT13	5
+
+#define ACIC	2
+#define ACD	7
+#define ADPS0	0
+#define ADPS1	1
+#define ADPS2	2
+#define ADIF	4
+#define ADIE	3
+#define ADSC	6
+#define ADEN	7
+#define REFS0	6
+
+#define MPCM0	0
+#define U2X0	1
+#define UPE0	2
+#define DOR0	3
+#define FE0	4
+#define UDRE0	5
+#define TXC0	6
+#define RXC0	7
+#define TXB80	0
+#define RXB80	1
+#define UCSZ02	2
+#define TXEN0	3
+#define RXEN0	4
+#define UDRIE0	5
+#define TXCIE0	6
+#define RXCIE0	7
+#define UCSZ00	1
+#define UCSZ01	2
+
+#define SE	0
+#define SM0	1
+#define SM1	2
+
+#endif
@@ -0,0 +1,28 @@
+/* avr/pgmspace.h replacement for the SDrive host simulation.
+ * There is only one address space on the host.
+ */
+#ifndef HOSTSIM_AVR_PGMSPACE_H
+#define HOSTSIM_AVR_PGMSPACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P			const char *
+#define PSTR(s)			(s)
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+#define pgm_read_dword(p)	(*(const uint32_t *)(p))
+#define pgm_read_ptr(p)		(*(void * const *)(p))
+#define sprintf_P		sprintf
+#define printf_P		printf
+#define strcpy_P		strcpy
+#define strncpy_P		strncpy
+#define strcmp_P		strcmp
+#define strncmp_P		strncmp
+#define strlen_P		strlen
+#define memcpy_P		memcpy
+#define memcmp_P		memcmp
+
+#endif
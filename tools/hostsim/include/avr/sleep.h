@@ -0,0 +1,14 @@
+/* avr/sleep.h replacement for the SDrive host simulation. */
+#ifndef HOSTSIM_AVR_SLEEP_H
+#define HOSTSIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE		0
+#define SLEEP_MODE_ADC		1
+#define SLEEP_MODE_PWR_DOWN	2
+#define set_sleep_mode(mode)	do { } while (0)
+#define sleep_enable()		do { } while (0)
+#define sleep_disable()		do { } while (0)
+#define sleep_cpu()		do { } while (0)
+#define sleep_mode()		do { } while (0)
+
+#endif
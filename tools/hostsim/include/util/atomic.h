@@ -0,0 +1,14 @@
+/* util/atomic.h replacement for the SDrive host simulation. */
+#ifndef HOSTSIM_UTIL_ATOMIC_H
+#define HOSTSIM_UTIL_ATOMIC_H
+
+#include <avr/io.h>
+
+static inline uint8_t hostsim_atomic_enter(void) { uint8_t s = SREG; cli(); return s | 1; }
+static inline void hostsim_atomic_restore(uint8_t *s) { SREG = *s & ~1; }
+
+#define ATOMIC_BLOCK(type)	for (uint8_t sreg_save __attribute__((cleanup(hostsim_atomic_restore))) = hostsim_atomic_enter(); sreg_save & 1; sreg_save &= ~1)
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#endif
@@ -0,0 +1,12 @@
+/* util/delay.h replacement for the SDrive host simulation.
+ * Busy waits advance the virtual clock instead of burning cycles.
+ */
+#ifndef HOSTSIM_UTIL_DELAY_H
+#define HOSTSIM_UTIL_DELAY_H
+
+void hostsim_delay_us(double us);
+
+#define _delay_us(us)	hostsim_delay_us(us)
+#define _delay_ms(ms)	hostsim_delay_us((ms) * 1000.0)
+
+#endif
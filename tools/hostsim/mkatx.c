@@ -0,0 +1,161 @@
+/* mkatx.c - build an ATX image from a single density ATR for the host simulation
+ *
+ *	mkatx [-p track] in.atr out.atx
+ *
+ *	-p	make this track (0-39, default 39) copy protected: sector 3 twice
+ *		with different data, sector 7 missing, a CRC error on sector 11
+ *		and weak data in sector 15 from byte 64 on
+ *
+ * The image has 40 tracks of 18 sectors, spread evenly over the rotation,
+ * in the layout atx.c reads: file header, then per track a track header,
+ * the sector list, one data chunk, the extended chunks and the terminator.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACKS		40
+#define SPT		18
+#define SECSIZE		128
+#define AU_FULL_ROTATION	26042
+
+#define ST_CRC		0x08
+#define ST_MISSING	0x10
+#define ST_EXTENDED	0x40
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+struct slot {
+	uint8_t number;
+	uint8_t status;
+	uint8_t fill;		// data differs from the ATR: xor with this
+};
+
+/* one track record, returns its size */
+static uint32_t build_track(uint8_t *t, uint8_t track, const uint8_t *atr, int protect)
+{
+	struct slot s[SPT + 1];
+	uint8_t *p;
+	uint32_t n = 0, i, data, weak = 0;
+
+	for (i = 0; i < SPT; i++) {
+		s[n].number = i + 1;
+		s[n].status = 0;
+		s[n].fill = 0;
+		if (protect) {
+			if (i + 1 == 7)
+				s[n].status = ST_MISSING;
+			else if (i + 1 == 11)
+				s[n].status = ST_CRC;
+			else if (i + 1 == 15) {
+				s[n].status = ST_EXTENDED;
+				weak = n;
+			}
+		}
+		n++;
+		if (protect && i + 1 == 3) {	// second copy half a turn later
+			s[n] = s[n - 1];
+			s[n].fill = 0xFF;
+			n++;
+		}
+	}
+
+	memset(t, 0, 32 + 8 + 8 * n + 8 + n * SECSIZE + 16);
+	// sector list
+	p = t + 32;
+	put32(p, 8 + 8 * n);
+	put16(p + 4, 1);
+	data = 32 + 8 + 8 * n + 8;
+	for (i = 0; i < n; i++) {
+		uint8_t *h = p + 8 + 8 * i;
+		uint8_t *d = t + data + i * SECSIZE;
+		const uint8_t *src = atr + ((uint32_t)track * SPT + s[i].number - 1) * SECSIZE;
+		uint32_t j;
+
+		h[0] = s[i].number;
+		h[1] = s[i].status;
+		put16(h + 2, (uint32_t)i * AU_FULL_ROTATION / n);
+		if (!(s[i].status & ST_MISSING))
+			put32(h + 4, data + i * SECSIZE);
+		for (j = 0; j < SECSIZE; j++)
+			d[j] = src[j] ^ s[i].fill;
+	}
+	// data chunk
+	p = t + data - 8;
+	put32(p, 8 + n * SECSIZE);
+	p = t + data + n * SECSIZE;
+	if (protect) {			// weak data
+		put32(p, 8);
+		p[4] = 0x10;
+		p[5] = weak;
+		put16(p + 6, 64);
+		p += 8;
+	}
+	p += 8;				// terminator
+	// track header
+	put32(t, p - t);
+	t[8] = track;
+	put16(t + 10, n);
+	put32(t + 20, 32);
+	return p - t;
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t atr[TRACKS * SPT * SECSIZE];
+	static uint8_t track[32 + 8 + 8 * (SPT + 1) + 8 + (SPT + 1) * SECSIZE + 16];
+	uint8_t hdr[48], ah[16];
+	int protect = 39, opt;
+	uint32_t size, t;
+	FILE *in, *out;
+
+	while ((opt = getopt(argc, argv, "p:")) != -1) {
+		switch (opt) {
+		case 'p': protect = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-p track] in.atr out.atx\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 2)
+		return 1;
+	in = fopen(argv[optind], "rb");
+	if (!in) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (fread(ah, 16, 1, in) != 1 || ah[0] != 0x96 || ah[1] != 0x02 || ah[4] != SECSIZE) {
+		fprintf(stderr, "%s: not a single density ATR\n", argv[optind]);
+		return 1;
+	}
+	if (!fread(atr, 1, sizeof(atr), in)) {
+		fprintf(stderr, "%s: empty\n", argv[optind]);
+		return 1;
+	}
+	fclose(in);
+	out = fopen(argv[optind + 1], "wb");
+	if (!out) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, "AT8X", 4);
+	put16(hdr + 4, 1);
+	put16(hdr + 6, 1);
+	put32(hdr + 28, sizeof(hdr));
+	fwrite(hdr, sizeof(hdr), 1, out);
+	for (t = 0; t < TRACKS; t++) {
+		size = build_track(track, t, atr, t == (uint32_t)protect);
+		fwrite(track, size, 1, out);
+	}
+	put32(hdr + 32, ftell(out));
+	fseek(out, 0, SEEK_SET);
+	fwrite(hdr, sizeof(hdr), 1, out);
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,325 @@
+/* mkfatimg.c - build a partitioned FAT16 SD card image for the host simulation
+ *
+ *	mkfatimg [-s MB] [-c sectors/cluster] [-F n] [-n count] [-D dir] out.img [file...]
+ *
+ *	-s	card size in MB (default 64)
+ *	-c	sectors per cluster (default 8)
+ *	-F	fragment the files: allocate them round robin in pieces of n clusters
+ *	-n	add count small dummy files (DUMMY001.ATR ...)
+ *	-D	put the dummy files into a subdirectory of that name
+ *
+ * Files are stored in the root directory under their upper-cased 8.3 name.
+ * The layout is what a card formatted by a PC looks like: MBR with one
+ * partition of type 06 at LBA 2048, two FATs, 512 root entries.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PART_LBA	2048
+#define ROOT_ENTS	512
+#define MAX_FILES	4096
+
+static FILE *out;
+static uint32_t spc = 8, fat_secs, first_fat, first_root, first_data, nclusters;
+static uint16_t *fat;
+static uint32_t next_free = 2;
+
+struct file {
+	char name[11];
+	uint8_t attr;
+	uint8_t *data;
+	uint32_t size;
+	uint32_t nclust;
+	uint32_t *clust;
+	uint32_t done;
+};
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void write_sector(uint32_t lba, const void *buf, uint32_t n)
+{
+	fseek(out, (long)lba * 512, SEEK_SET);
+	fwrite(buf, 512, n, out);
+}
+
+static uint32_t cluster_lba(uint32_t c)
+{
+	return first_data + (c - 2) * spc;
+}
+
+static int to83(const char *path, char *name)
+{
+	const char *base = strrchr(path, '/');
+	const char *dot;
+	int i, n;
+
+	base = base ? base + 1 : path;
+	dot = strrchr(base, '.');
+	memset(name, ' ', 11);
+	n = dot ? dot - base : (int)strlen(base);
+	if (n < 1 || n > 8)
+		return -1;
+	for (i = 0; i < n; i++)
+		name[i] = toupper((unsigned char)base[i]);
+	if (dot) {
+		n = strlen(dot + 1);
+		if (n > 3)
+			return -1;
+		for (i = 0; i < n; i++)
+			name[8 + i] = toupper((unsigned char)dot[1 + i]);
+	}
+	return 0;
+}
+
+static void make_dirent(uint8_t *e, const struct file *f)
+{
+	memset(e, 0, 32);
+	memcpy(e, f->name, 11);
+	e[11] = f->attr;
+	put16(e + 22, 0x6000);			// 12:00
+	put16(e + 24, (46 << 9) | (1 << 5) | 1);	// 2026-01-01
+	put16(e + 26, f->nclust ? f->clust[0] : 0);
+	put16(e + 20, f->nclust ? f->clust[0] >> 16 : 0);
+	put32(e + 28, (f->attr & 0x10) ? 0 : f->size);
+}
+
+/* allocate the clusters; with frag > 0 the files take turns */
+static void allocate(struct file *files, int nfiles, uint32_t frag)
+{
+	int i, left;
+
+	for (i = 0; i < nfiles; i++) {
+		files[i].nclust = (files[i].size + spc * 512 - 1) / (spc * 512);
+		if (files[i].attr & 0x10 && !files[i].nclust)
+			files[i].nclust = 1;
+		files[i].clust = calloc(files[i].nclust + 1, sizeof(uint32_t));
+		files[i].done = 0;
+	}
+	do {
+		left = 0;
+		for (i = 0; i < nfiles; i++) {
+			struct file *f = &files[i];
+			uint32_t n = frag ? frag : f->nclust;
+
+			while (n-- && f->done < f->nclust) {
+				if (next_free >= nclusters + 2) {
+					fprintf(stderr, "image full\n");
+					exit(1);
+				}
+				f->clust[f->done] = next_free++;
+				if (f->done)
+					fat[f->clust[f->done - 1]] = f->clust[f->done];
+				f->done++;
+			}
+			if (f->done < f->nclust)
+				left = 1;
+			else if (f->nclust)
+				fat[f->clust[f->nclust - 1]] = 0xFFFF;
+		}
+	} while (left);
+}
+
+static void store(const struct file *f)
+{
+	uint32_t i;
+	uint8_t *buf = calloc(spc, 512);
+
+	for (i = 0; i < f->nclust; i++) {
+		uint32_t off = i * spc * 512;
+		uint32_t n = f->size - off < spc * 512 ? f->size - off : spc * 512;
+
+		memset(buf, 0, spc * 512);
+		if (f->data && off < f->size)
+			memcpy(buf, f->data + off, n);
+		write_sector(cluster_lba(f->clust[i]), buf, spc);
+	}
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t mb = 64, frag = 0, ndummy = 0, total, i;
+	const char *dirname = NULL;
+	static struct file files[MAX_FILES];
+	int nfiles = 0, nroot, opt;
+	uint8_t sec[512];
+	uint8_t *root;
+	struct file *dir = NULL;
+
+	while ((opt = getopt(argc, argv, "s:c:F:n:D:")) != -1) {
+		switch (opt) {
+		case 's': mb = atoi(optarg); break;
+		case 'c': spc = atoi(optarg); break;
+		case 'F': frag = atoi(optarg); break;
+		case 'n': ndummy = atoi(optarg); break;
+		case 'D': dirname = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-s MB] [-c spc] [-F n] [-n count] [-D dir] out.img [file...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || !spc || (spc & (spc - 1)))
+		return 1;
+	out = fopen(argv[optind++], "w+b");
+	if (!out) {
+		perror("open");
+		return 1;
+	}
+
+	total = mb * 2048;
+	// FAT16 geometry: solve for the FAT size
+	{
+		uint32_t part = total - PART_LBA;
+		uint32_t data;
+		fat_secs = 1;
+		for (;;) {
+			data = part - 1 - 2 * fat_secs - ROOT_ENTS / 16;
+			nclusters = data / spc;
+			if ((nclusters + 2) * 2 <= fat_secs * 512)
+				break;
+			fat_secs++;
+		}
+		if (nclusters < 4085 || nclusters > 65524) {
+			fprintf(stderr, "%u clusters do not make a FAT16, change -s or -c\n", nclusters);
+			return 1;
+		}
+	}
+	first_fat = PART_LBA + 1;
+	first_root = first_fat + 2 * fat_secs;
+	first_data = first_root + ROOT_ENTS / 16;
+	fat = calloc(fat_secs * 256, sizeof(uint16_t));
+	fat[0] = 0xFFF8;
+	fat[1] = 0xFFFF;
+
+	// input files
+	for (; optind < argc; optind++) {
+		struct file *f = &files[nfiles];
+		FILE *in = fopen(argv[optind], "rb");
+
+		if (!in || to83(argv[optind], f->name)) {
+			fprintf(stderr, "%s: cannot use\n", argv[optind]);
+			return 1;
+		}
+		fseek(in, 0, SEEK_END);
+		f->size = ftell(in);
+		rewind(in);
+		f->data = malloc(f->size + 1);
+		if (fread(f->data, 1, f->size, in) != f->size)
+			return 1;
+		fclose(in);
+		f->attr = 0x20;
+		nfiles++;
+	}
+	nroot = nfiles;
+	if (dirname && ndummy) {
+		dir = &files[nfiles++];
+		if (to83(dirname, dir->name))
+			return 1;
+		dir->attr = 0x10;
+		dir->size = (ndummy + 2) * 32;
+		nroot++;
+	}
+	for (i = 0; i < ndummy && nfiles < MAX_FILES; i++) {
+		struct file *f = &files[nfiles++];
+		char n[16];
+
+		snprintf(n, sizeof(n), "DUMMY%03u.ATR", i);
+		if (i >= 1000)
+			snprintf(n, sizeof(n), "DUM%05u.ATR", i);
+		to83(n, f->name);
+		f->attr = 0x20;
+		f->size = 16 + 720 * 128;
+		f->data = calloc(1, f->size);
+		f->data[0] = 0x96;
+		f->data[1] = 0x02;
+		f->data[2] = (f->size - 16) >> 4;
+		f->data[3] = (f->size - 16) >> 12;
+		f->data[4] = 0x80;
+		if (!dir)
+			nroot++;
+	}
+	if (nroot > ROOT_ENTS) {
+		fprintf(stderr, "too many root entries, use -D\n");
+		return 1;
+	}
+	allocate(files, nfiles, frag);
+
+	// subdirectory content
+	if (dir) {
+		uint8_t *d = calloc(dir->nclust, spc * 512);
+		struct file dot = *dir, dotdot = *dir;
+		int k = 0;
+
+		memcpy(dot.name, ".          ", 11);
+		memcpy(dotdot.name, "..         ", 11);
+		dotdot.nclust = 0;
+		make_dirent(d + 32 * k++, &dot);
+		make_dirent(d + 32 * k++, &dotdot);
+		for (i = dir - files + 1; i < (uint32_t)nfiles; i++)
+			make_dirent(d + 32 * k++, &files[i]);
+		dir->data = d;
+		dir->size = dir->nclust * spc * 512;
+	}
+	for (i = 0; i < (uint32_t)nfiles; i++)
+		store(&files[i]);
+
+	// root directory
+	root = calloc(ROOT_ENTS / 16, 512);
+	{
+		int k = 0;
+		for (i = 0; i < (uint32_t)nfiles; i++) {
+			if (dir && &files[i] > dir)
+				break;
+			make_dirent(root + 32 * k++, &files[i]);
+		}
+	}
+	write_sector(first_root, root, ROOT_ENTS / 16);
+
+	// FATs
+	write_sector(first_fat, fat, fat_secs);
+	write_sector(first_fat + fat_secs, fat, fat_secs);
+
+	// boot sector
+	memset(sec, 0, 512);
+	sec[0] = 0xEB; sec[1] = 0x3C; sec[2] = 0x90;
+	memcpy(sec + 3, "SDRVSIM ", 8);
+	put16(sec + 11, 512);
+	sec[13] = spc;
+	put16(sec + 14, 1);
+	sec[16] = 2;
+	put16(sec + 17, ROOT_ENTS);
+	if (total - PART_LBA < 65536)
+		put16(sec + 19, total - PART_LBA);
+	else
+		put32(sec + 32, total - PART_LBA);
+	sec[21] = 0xF8;
+	put16(sec + 22, fat_secs);
+	put16(sec + 24, 63);
+	put16(sec + 26, 255);
+	put32(sec + 28, PART_LBA);
+	sec[36] = 0x80;
+	sec[38] = 0x29;
+	memcpy(sec + 43, "SDRIVE SIM FAT16   ", 19);
+	sec[510] = 0x55; sec[511] = 0xAA;
+	write_sector(PART_LBA, sec, 1);
+
+	// MBR
+	memset(sec, 0, 512);
+	sec[446 + 4] = 0x06;
+	put32(sec + 446 + 8, PART_LBA);
+	put32(sec + 446 + 12, total - PART_LBA);
+	sec[510] = 0x55; sec[511] = 0xAA;
+	write_sector(0, sec, 1);
+
+	// full size
+	memset(sec, 0, 512);
+	write_sector(total - 1, sec, 1);
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,347 @@
+/* sdcard.c - SDrive host simulation: SPI master and an SD card in SPI mode
+ *
+ * Replaces spi.c.  The card understands the commands mmc.c uses
+ * (CMD0/1/8/12/13/16/17/18/24/25/55/58, ACMD23/41) and is backed by a raw
+ * image file.  Every byte clocked over the bus advances the virtual clock
+ * by the SPI wire time plus SIM_SPI_CALL_CYCLES (SIM_SPI_BLOCK_CYCLES in
+ * the block transfers); the card holds back data tokens and keeps MISO low
+ * while programming, so the firmware's polling loops spend the card latency
+ * the same way they would on hardware.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "spi.h"
+#include "mmcconf.h"
+#include "hostsim.h"
+
+struct sd_stats sd_stats;
+
+static FILE *img;
+static uint64_t img_sectors;
+static uint8_t sdhc;
+
+static uint32_t fat_first, fat_count;	// sector range booked as PH_FAT
+
+enum { CARD_OFF, CARD_IDLE, CARD_READY };
+enum { M_CMD, M_READ_STREAM, M_WRITE_TOKEN, M_WRITE_DATA, M_MWRITE_TOKEN, M_MWRITE_DATA };
+
+static uint8_t card_state;
+static uint8_t mode;
+static uint8_t app_cmd;
+static uint8_t cmd[6], cmd_len;
+static uint32_t cur_sector;		// sector of the transfer in progress
+static uint32_t erased_left;		// blocks left of the ACMD23 pre-erase
+
+static uint8_t resp[8], resp_len, resp_pos;	// immediate response bytes
+static uint8_t data[515];
+static uint16_t data_len, data_pos;		// data token + block + crc
+static uint64_t data_ready;			// data held back until then
+static uint64_t busy_until;			// card programming
+
+static uint8_t wbuf[514];
+static uint16_t wpos;
+
+int sd_open(const char *path, int is_sdhc)
+{
+	img = fopen(path, "r+b");
+	if (!img)
+		return -1;
+	fseek(img, 0, SEEK_END);
+	img_sectors = ftell(img) / 512;
+	sdhc = is_sdhc;
+	card_state = CARD_OFF;
+	mode = M_CMD;
+	memset(&sd_stats, 0, sizeof(sd_stats));
+	return 0;
+}
+
+void sd_close(void)
+{
+	if (img)
+		fclose(img);
+	img = NULL;
+}
+
+void sd_set_fat_range(uint32_t first, uint32_t count)
+{
+	fat_first = first;
+	fat_count = count;
+}
+
+static void load_block(uint32_t sector)
+{
+	data[0] = 0xFE;
+	memset(data + 1, 0, 512);
+	if (sector < img_sectors) {
+		fseek(img, (long)sector * 512, SEEK_SET);
+		if (fread(data + 1, 512, 1, img) != 1)
+			memset(data + 1, 0, 512);
+	}
+	data[513] = data[514] = 0xFF;	// crc, not checked by the firmware
+	data_len = 515;
+	data_pos = 0;
+}
+
+static void store_block(uint32_t sector)
+{
+	if (sector < img_sectors) {
+		fseek(img, (long)sector * 512, SEEK_SET);
+		fwrite(wbuf, 512, 1, img);
+		fflush(img);
+	}
+	sd_stats.blocks_written++;
+}
+
+static void respond(uint8_t r1)
+{
+	resp[0] = 0xFF;		// NCR
+	resp[1] = r1;
+	resp_len = 2;
+	resp_pos = 0;
+}
+
+static void execute(void)
+{
+	uint8_t c = cmd[0] & 0x3F;
+	uint32_t arg = ((uint32_t)cmd[1] << 24) | ((uint32_t)cmd[2] << 16) | ((uint32_t)cmd[3] << 8) | cmd[4];
+	uint32_t sector = sdhc ? arg : arg >> 9;
+	uint8_t idle = (card_state != CARD_READY);
+	uint8_t acmd = app_cmd;
+
+	sd_stats.commands++;
+	sd_stats.cmd_count[c]++;
+	if (sim_now < busy_until && c != 12 && c != 13)
+		sd_stats.busy_violations++;
+
+	app_cmd = 0;
+	data_len = data_pos = 0;
+
+	if (mode == M_READ_STREAM && c == 12) {
+		mode = M_CMD;
+		resp[0] = 0xFF;		// stuff byte
+		resp[1] = 0xFF;
+		resp[2] = 0x00;
+		resp_len = 3;
+		resp_pos = 0;
+		busy_until = sim_now + HOSTSIM_US(SIM_SD_CMD12_BUSY_US);
+		return;
+	}
+	mode = M_CMD;
+
+	if (c == 0) {
+		card_state = CARD_IDLE;
+		respond(0x01);
+		return;
+	}
+	if (card_state == CARD_OFF) {
+		respond(0xFF);
+		return;
+	}
+	if (acmd && c == 41) {
+		card_state = CARD_READY;
+		respond(0x00);
+		return;
+	}
+	if (acmd && c == 23) {
+		erased_left = arg & 0x7FFFFF;
+		respond(0x00);
+		return;
+	}
+	switch (c) {
+	case 1:
+		card_state = CARD_READY;
+		respond(0x00);
+		break;
+	case 8:
+		respond(idle);
+		resp[2] = 0x00;
+		resp[3] = 0x00;
+		resp[4] = cmd[3] & 0x0F;
+		resp[5] = cmd[4];
+		resp_len = 6;
+		break;
+	case 12:
+		respond(0x00);
+		break;
+	case 13:
+		respond(0x00);
+		resp[2] = 0x00;
+		resp_len = 3;
+		break;
+	case 16:
+		respond(0x00);
+		break;
+	case 55:
+		app_cmd = 1;
+		respond(idle);
+		break;
+	case 58:
+		respond(idle);
+		resp[2] = sdhc ? 0xC0 : 0x80;
+		resp[3] = 0xFF;
+		resp[4] = 0x80;
+		resp[5] = 0x00;
+		resp_len = 6;
+		break;
+	case 17:
+	case 18:
+		respond(0x00);
+		cur_sector = sector;
+		load_block(cur_sector);
+		data_ready = sim_now + HOSTSIM_US(SIM_SD_READ_LATENCY_US);
+		if (c == 18)
+			mode = M_READ_STREAM;
+		break;
+	case 24:
+	case 25:
+		respond(0x00);
+		cur_sector = sector;
+		mode = (c == 24) ? M_WRITE_TOKEN : M_MWRITE_TOKEN;
+		if (c == 24)
+			erased_left = 0;
+		break;
+	default:
+		respond(0x04);	// illegal command
+	}
+}
+
+/* card output for the byte being clocked now */
+static uint8_t card_out(void)
+{
+	if (resp_pos < resp_len)
+		return resp[resp_pos++];
+	if (data_pos < data_len) {
+		if (sim_now < data_ready)
+			return 0xFF;
+		if (data_pos == 512)
+			sd_stats.blocks_read++;	// a block cut off by CMD12 does not count
+		return data[data_pos++];
+	}
+	if (mode == M_READ_STREAM) {
+		load_block(++cur_sector);
+		data_ready = sim_now + HOSTSIM_US(SIM_SD_STREAM_GAP_US);
+		return 0xFF;
+	}
+	if (sim_now < busy_until)
+		return 0x00;
+	return 0xFF;
+}
+
+/* card input for the byte being clocked now */
+static void card_in(uint8_t b)
+{
+	switch (mode) {
+	case M_WRITE_TOKEN:
+	case M_MWRITE_TOKEN:
+		if (mode == M_MWRITE_TOKEN && b == 0xFD) {	// stop tran
+			mode = M_CMD;
+			resp[0] = 0xFF;
+			resp_len = 1;
+			resp_pos = 0;
+			busy_until = sim_now + HOSTSIM_US(SIM_SD_STOP_BUSY_US);
+			return;
+		}
+		if ((mode == M_WRITE_TOKEN && b == 0xFE) || (mode == M_MWRITE_TOKEN && b == 0xFC)) {
+			mode++;
+			wpos = 0;
+		}
+		else if (b != 0xFF)	// anything else starts a new command
+			break;
+		return;
+	case M_WRITE_DATA:
+	case M_MWRITE_DATA:
+		wbuf[wpos++] = b;
+		if (wpos == 514) {
+			uint64_t busy;
+
+			store_block(cur_sector);
+			if (mode == M_WRITE_DATA) {
+				busy = SIM_SD_WRITE_BUSY_US;
+				mode = M_CMD;
+			}
+			else {
+				busy = erased_left ? SIM_SD_ERASED_BUSY_US : SIM_SD_MWRITE_BUSY_US;
+				if (erased_left)
+					erased_left--;
+				cur_sector++;
+				mode = M_MWRITE_TOKEN;
+			}
+			resp[0] = 0xE5;		// data response: accepted
+			resp_len = 1;
+			resp_pos = 0;
+			busy_until = sim_now + HOSTSIM_US(busy);
+		}
+		return;
+	}
+
+	if (cmd_len == 0 && (b & 0xC0) != 0x40)
+		return;
+	cmd[cmd_len++] = b;
+	if (cmd_len == 6) {
+		cmd_len = 0;
+		execute();
+	}
+}
+
+static uint16_t spi_divider(void)
+{
+	static const uint8_t div[4] = { 4, 16, 64, 128 };
+	uint16_t d = div[SPCR & 3];
+
+	if (SPSR & _BV(SPI2X))
+		d /= 2;
+	return d;
+}
+
+void spiInit(void)
+{
+	PORTB |= _BV(MMC_CS_PIN);
+	SPSR &= ~_BV(SPI2X);
+	SPCR = (_BV(SPR0)|_BV(SPR1)|_BV(MSTR)|_BV(SPE));
+}
+
+static u08 spi_transfer(u08 b, uint16_t cycles)
+{
+	u08 r = 0xFF;
+	enum sim_phase ph = PH_SD;
+
+	sd_stats.spi_bytes++;
+	if (!(PORTB & _BV(MMC_CS_PIN)) && img) {
+		r = card_out();
+		card_in(b);
+		if (fat_count && cur_sector - fat_first < fat_count)
+			ph = PH_FAT;
+	}
+	sim_advance(8 * spi_divider() + cycles, ph);
+	SPDR = r;
+	return r;
+}
+
+u08 spiTransferByte(u08 b)
+{
+	return spi_transfer(b, SIM_SPI_CALL_CYCLES);
+}
+
+void spiReceiveBlock(u08 *buff, u16 len)
+{
+	while (len--)
+		*buff++ = spi_transfer(0xFF, SIM_SPI_BLOCK_CYCLES);
+}
+
+void spiSendBlock(const u08 *buff, u16 len)
+{
+	while (len--)
+		spi_transfer(*buff++, SIM_SPI_BLOCK_CYCLES);
+}
+
+void spiSendByte(u08 b)
+{
+	spiTransferByte(b);
+}
+
+u08 spiTransferFF(void)
+{
+	return spiTransferByte(0xFF);
+}
@@ -0,0 +1,531 @@
+/* sdrive-sim.c - run the SDrive firmware core on the host
+ *
+ *	sdrive-sim [-v] [-S] [-f text|csv|json] card.img script...
+ *
+ * Boots the firmware like main() does (card init, FAT init, SDRIVE.ATR in
+ * D0:) and then plays the scripts, one SIO transaction per line:
+ *
+ *	mount <n> <NAME.EXT>		put file of the current dir into vDn: ($EC)
+ *	swap <n>			vDn: becomes D1: ($EE)
+ *	read <D> <sector> [count]	$52 to D<D>:
+ *	write <D> <sector> [fill]	$57 to D<D>:, sector filled with fill
+ *	status <D>			$53
+ *	format <D>			$21
+ *	sio <dev> <cmd> <aux1> <aux2> [data-bytes...]	raw frame, hex
+ *	idle <ms>			main loop runs with interrupts on, the steps
+ *					of the sorted index build (SDRIVE.IDX) first
+ *	save				Cfg SaveIm: D1:-D4: to image_store in the eeprom
+ *	restore				power cycle: D1:-D4: from the eeprom, as main()
+ *
+ * and a few that replay what the Atari does, driven by the data it gets:
+ *
+ *	boot <D>			OS boot: sector 1, then as many as it says
+ *	dir <D>				DOS 2 directory: VTOC and sectors 361-368
+ *	load <D> <NAME.EXT>		DOS 2: find the file, follow its sector links
+ *	xex <D>				SDrive XEX loader: sectors 1-2, then $171...
+ *
+ * For every transaction one line with the latency from command line low to
+ * the last byte on the wire, the response, a crc32 of the data frame and
+ * the time by phase; -f csv or json (one object per line) for tools.
+ * -S simulates a standard capacity (byte addressed) card.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "avrlibtypes.h"
+#include "global.h"
+#include "mmc.h"
+#include "fat.h"
+#include "usart.h"
+#include "tft.h"
+#include "dirindex.h"
+#include "atx.h"
+#include "hostsim.h"
+
+int sim_verbose;
+
+enum { OUT_TEXT, OUT_CSV, OUT_JSON };
+static int out_format = OUT_TEXT;
+static const char *script_name = "init";
+static int script_line;
+
+extern struct GlobalSystemValues GS;
+extern struct FileInfoStruct FileInfo;
+extern virtual_disk_t vDisk[DEVICESNUM];
+extern virtual_disk_t tmpvDisk;
+extern struct flags SDFlags;
+extern struct display tft;
+extern unsigned char atari_sector_buffer[256];
+extern unsigned char actual_page;
+extern uint8_t system_fastsio_pokeydiv_default;
+extern struct {
+	u08 p0, p1, p2, p3;
+	u32 p4_5_6_7;
+} sdrparams;
+extern struct file_save image_store[DEVICESNUM-1];
+
+void save_images();
+unsigned char mount_restore(unsigned char drive);
+void drive_button_name(unsigned char drive);
+
+static uint32_t crc32(const uint8_t *p, uint32_t n)
+{
+	uint32_t c = 0xFFFFFFFF;
+	int k;
+
+	while (n--) {
+		c ^= *p++;
+		for (k = 0; k < 8; k++)
+			c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+	}
+	return ~c;
+}
+
+/* the part of main() in front of the main loop */
+static int boot(void)
+{
+	u08 r;
+	u08 i;
+
+	OCR1A = 26042U * 2;
+	TIMSK1 |= _BV(OCIE1A);
+	sdrparams.p2 = eeprom_read_byte(&system_fastsio_pokeydiv_default);
+	tft_Setup();
+	actual_page = 9;	// not on the main page, no button redraws
+	USART_Init((0x28 + 12) * 2);
+
+	mmcInit();
+	r = mmcReset();
+	if (r) {
+		fprintf(stderr, "mmcReset: %u\n", r);
+		return -1;
+	}
+	SPSR |= _BV(SPI2X);
+	SPCR &= ~(_BV(SPR1) | _BV(SPR0));
+
+	for (i = 0; i < DEVICESNUM; i++)
+		vDisk[i].flags = 0;
+	FileInfo.vDisk = &tmpvDisk;
+	r = fatInit();
+	if (r) {
+		fprintf(stderr, "fatInit: %u\n", r);
+		return -1;
+	}
+	tmpvDisk.dir_cluster = RootDirCluster;
+	dirIndexInit();
+	sd_set_fat_range(FirstFATSector, 2 * FATSectors);
+	return 0;
+}
+
+void index_step(void);
+
+/* the main loop for ms: the index build a step at a time, then idling */
+static void run_idle(double ms)
+{
+	uint64_t end = sim_now + HOSTSIM_US(ms * 1000), t, longest = 0;
+	unsigned steps = 0;
+	uint8_t sreg = SREG;
+
+	SREG |= _BV(SREG_I);
+	while (sim_now < end && dirIndexBusy()) {
+		t = sim_now;
+		index_step();
+		if (sim_now - t > longest)
+			longest = sim_now - t;
+		steps++;
+	}
+	SREG = sreg;
+	if (steps && sim_verbose)
+		fprintf(stderr, "%s:%d: %u index steps, longest %.0f us%s\n", script_name, script_line,
+			steps, longest / (F_CPU / 1000000.0), dirIndexBusy() ? ", not done" : "");
+	if (sim_now < end)
+		sim_run_idle(end - sim_now);
+}
+
+struct cmd_stats {
+	uint64_t phase[PH_MAX];
+	struct sd_stats sd;
+};
+
+static void snapshot(struct cmd_stats *s)
+{
+	memcpy(s->phase, sim_phase_cycles, sizeof(s->phase));
+	s->sd = sd_stats;
+}
+
+static double us(uint64_t cycles)
+{
+	return cycles / (F_CPU / 1000000.0);
+}
+
+static void print_result(const struct sio_result *r, const struct cmd_stats *a,
+			 const struct cmd_stats *b, uint8_t dev, uint8_t cmd,
+			 uint8_t aux1, uint8_t aux2, const char *resp,
+			 uint16_t dlen, uint32_t crc, const char *what)
+{
+	unsigned long long rd = b->sd.blocks_read - a->sd.blocks_read;
+	unsigned long long wr = b->sd.blocks_written - a->sd.blocks_written;
+	int i;
+
+	switch (out_format) {
+	case OUT_TEXT:
+		printf("%10.3f ms  %02x %02x %02x%02x  %9.1f us  %-4s %4u  %08x  sd=%llu/%llu  %s\n",
+		       us(r->start) / 1000, dev, cmd, aux2, aux1, us(r->end - r->start),
+		       resp, dlen, crc, rd, wr, what);
+		break;
+	case OUT_CSV:
+		printf("%s,%d,%s,%02x,%02x,%02x%02x,%.1f,%.1f,%s,%u,%08x,%llu,%llu",
+		       script_name, script_line, what, dev, cmd, aux2, aux1,
+		       us(r->start), us(r->end - r->start), resp, dlen, crc, rd, wr);
+		for (i = 0; i < PH_MAX; i++)
+			printf(",%.1f", us(b->phase[i] - a->phase[i]));
+		printf("\n");
+		break;
+	case OUT_JSON:
+		printf("{\"script\":\"%s\",\"line\":%d,\"what\":\"%s\",\"dev\":%u,\"cmd\":%u,\"aux\":%u,"
+		       "\"start_us\":%.1f,\"latency_us\":%.1f,\"answer\":\"%s\",\"len\":%u,\"crc32\":\"%08x\","
+		       "\"sd_read\":%llu,\"sd_written\":%llu",
+		       script_name, script_line, what, dev, cmd, aux1 | (aux2 << 8),
+		       us(r->start), us(r->end - r->start), resp, dlen, crc, rd, wr);
+		for (i = 0; i < PH_MAX; i++)
+			printf(",\"%s_us\":%.1f", sim_phase_name[i], us(b->phase[i] - a->phase[i]));
+		printf("}\n");
+		break;
+	}
+}
+
+/* one complete SIO transaction, like the Atari sees it; the data frame
+ * goes to frame (if given), returns its length */
+static uint16_t transact(uint8_t dev, uint8_t cmd, uint8_t aux1, uint8_t aux2,
+			 const uint8_t *data, uint16_t len, const char *what,
+			 uint8_t *frame)
+{
+	struct sio_result r;
+	struct cmd_stats a, b;
+	char resp[8];
+	uint16_t i, n = 0, dlen = 0;
+	uint32_t crc = 0;
+
+	snapshot(&a);
+	sio_begin_command(dev, cmd, aux1, aux2, data, len);
+	SREG &= ~_BV(SREG_I);	// the command line went low: interrupt entry
+	PCINT1_vect();
+	SREG |= _BV(SREG_I);	// reti, back in the main loop
+	sio_finish(&r);
+	snapshot(&b);
+
+	// ACK/NAK [ACK] COMPLETE/ERROR [data checksum]
+	for (i = 0; i < r.rx_len && n < sizeof(resp) - 1; i++) {
+		resp[n++] = r.rx[i];
+		if (r.rx[i] == 'C' || r.rx[i] == 'E' || r.rx[i] == 'N') {
+			i++;
+			break;
+		}
+	}
+	resp[n] = 0;
+	if (i < r.rx_len) {
+		uint16_t k, sum = 0;
+
+		dlen = r.rx_len - i - 1;
+		crc = crc32(r.rx + i, dlen);
+		for (k = 0; k < dlen; k++) {
+			sum += r.rx[i + k];
+			if (sum > 0xFF)
+				sum = (sum & 0xFF) + 1;
+		}
+		if (sum != r.rx[r.rx_len - 1] && n < sizeof(resp) - 1) {
+			resp[n++] = '!';	// bad data frame checksum
+			resp[n] = 0;
+		}
+		if (frame)
+			memcpy(frame, r.rx + i, dlen);
+	}
+	print_result(&r, &a, &b, dev, cmd, aux1, aux2, resp, dlen, crc, what);
+	return dlen;
+}
+
+/* main(): the drive from its mount record, or by file_index as before */
+static void restore_drive(uint8_t i)
+{
+	struct sio_result r;
+	struct cmd_stats a, b;
+	struct file_save fs;
+
+	vDisk[i].flags = 0;
+	snapshot(&a);
+	r.start = sim_now;
+	if (mount_restore(i)) {
+		drive_button_name(i);
+		if (vDisk[i].flags & FLAGS_ATXTYPE)
+			loadAtxFile();
+		r.end = sim_now;
+		snapshot(&b);
+		print_result(&r, &a, &b, 0x71, 0xF0 | i, 0, 0, "C", 0, 0, "restore");
+		return;
+	}
+	eeprom_read_block(&fs, &image_store[i - 1], sizeof(fs));
+	if (fs.dir_cluster == 0xffffffff)
+		return;
+	tmpvDisk.dir_cluster = fs.dir_cluster;
+	transact(0x71, 0xF0 | i, fs.file_index & 0xFF, fs.file_index >> 8, NULL, 0, "restore", NULL);
+}
+
+static int parse_name(const char *s, uint8_t *pat)
+{
+	const char *dot = strchr(s, '.');
+	int i, n;
+
+	memset(pat, ' ', 11);
+	n = dot ? dot - s : (int)strlen(s);
+	if (n < 1 || n > 8)
+		return -1;
+	for (i = 0; i < n; i++)
+		pat[i] = toupper((unsigned char)s[i]);
+	if (dot)
+		for (i = 0; dot[1 + i] && i < 3; i++)
+			pat[8 + i] = toupper((unsigned char)dot[1 + i]);
+	return 0;
+}
+
+static uint16_t sector_size(uint8_t drive, uint16_t sector)
+{
+	virtual_disk_t *d = &vDisk[drive];
+
+	if ((d->flags & FLAGS_ATRDOUBLESECTORS) && sector > 3)
+		return 256;
+	return 128;
+}
+
+static int drive_of(uint8_t dev_no)
+{
+	if (dev_no == 1)
+		return sdrparams.p0;
+	return dev_no;
+}
+
+static uint16_t read_sector(uint8_t d, uint16_t s, uint8_t *buf, const char *what)
+{
+	return transact(0x30 + d, 0x52, s & 0xFF, s >> 8, NULL, 0, what, buf);
+}
+
+/* DOS 2: directory entry of the file, 0 if not there */
+static uint16_t dos_find(uint8_t d, const uint8_t *pat, const char *what)
+{
+	uint8_t buf[1024];
+	uint16_t s, e;
+
+	for (s = 361; s <= 368; s++) {
+		if (read_sector(d, s, buf, what) < 128)
+			return 0;
+		for (e = 0; e < 128; e += 16) {
+			if (!buf[e])
+				return 0;	// end of the directory
+			if ((buf[e] & 0x42) == 0x42 && !(buf[e] & 0x80) &&
+			    !memcmp(buf + e + 5, pat, 11))
+				return buf[e + 3] | (buf[e + 4] << 8);
+		}
+	}
+	return 0;
+}
+
+/* DOS 2: the file's sectors, linked by the last three bytes of each */
+static void dos_load(uint8_t d, uint16_t s, const char *what)
+{
+	uint8_t buf[1024];
+	uint16_t n, k = 0;
+
+	while (s && k++ < 4096) {
+		n = read_sector(d, s, buf, what);
+		if (n < 128)
+			break;
+		s = ((buf[n - 3] & 3) << 8) | buf[n - 2];
+	}
+}
+
+static void run_line(char *line)
+{
+	char *argv[300];
+	int argc = 0;
+	char *t;
+	uint8_t buf[1024];
+
+	t = strchr(line, '#');
+	if (t)
+		*t = 0;
+	for (t = strtok(line, " \t\r\n"); t && argc < 300; t = strtok(NULL, " \t\r\n"))
+		argv[argc++] = t;
+	if (!argc)
+		return;
+
+	if (!strcmp(argv[0], "mount") && argc == 3) {
+		if (parse_name(argv[2], buf))
+			return;
+		transact(0x71, 0xEC, atoi(argv[1]), 1, buf, 11, argv[2], NULL);
+	}
+	else if (!strcmp(argv[0], "swap") && argc == 2)
+		transact(0x71, 0xEE, atoi(argv[1]), 0, NULL, 0, "swap", NULL);
+	else if (!strcmp(argv[0], "read") && argc >= 3) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s = strtoul(argv[2], NULL, 0);
+		uint16_t n = argc > 3 ? strtoul(argv[3], NULL, 0) : 1;
+
+		while (n--)
+			read_sector(d, s++, NULL, "read");
+	}
+	else if (!strcmp(argv[0], "write") && argc >= 3) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s = strtoul(argv[2], NULL, 0);
+
+		memset(buf, argc > 3 ? strtoul(argv[3], NULL, 16) : s, sizeof(buf));
+		transact(0x30 + d, 0x57, s & 0xFF, s >> 8, buf, sector_size(drive_of(d), s), "write", NULL);
+	}
+	else if (!strcmp(argv[0], "status") && argc == 2)
+		transact(0x30 + atoi(argv[1]), 0x53, 0, 0, NULL, 0, "status", NULL);
+	else if (!strcmp(argv[0], "format") && argc == 2)
+		transact(0x30 + atoi(argv[1]), 0x21, 0, 0, NULL, 0, "format", NULL);
+	else if (!strcmp(argv[0], "sio") && argc >= 5) {
+		int i;
+
+		for (i = 5; i < argc; i++)
+			buf[i - 5] = strtoul(argv[i], NULL, 16);
+		transact(strtoul(argv[1], NULL, 16), strtoul(argv[2], NULL, 16),
+			 strtoul(argv[3], NULL, 16), strtoul(argv[4], NULL, 16),
+			 argc > 5 ? buf : NULL, argc - 5, "sio", NULL);
+	}
+	else if (!strcmp(argv[0], "idle") && argc == 2)
+		run_idle(atof(argv[1]));
+	else if (!strcmp(argv[0], "save") && argc == 1)
+		save_images();
+	else if (!strcmp(argv[0], "restore") && argc == 1) {
+		uint8_t i;
+
+		for (i = 1; i < DEVICESNUM; i++)
+			restore_drive(i);
+	}
+	else if (!strcmp(argv[0], "boot") && argc == 2) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s, n;
+
+		if (read_sector(d, 1, buf, "boot") < 128)
+			return;
+		n = buf[1] ? buf[1] : 256;
+		for (s = 2; s <= n; s++)
+			read_sector(d, s, NULL, "boot");
+	}
+	else if (!strcmp(argv[0], "dir") && argc == 2) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s;
+
+		read_sector(d, 360, NULL, "dir");
+		for (s = 361; s <= 368; s++) {
+			if (read_sector(d, s, buf, "dir") < 128 || !buf[0])
+				break;
+		}
+	}
+	else if (!strcmp(argv[0], "load") && argc == 3) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s;
+
+		if (parse_name(argv[2], buf + 512))
+			return;
+		s = dos_find(d, buf + 512, argv[2]);
+		if (s)
+			dos_load(d, s, argv[2]);
+		else
+			fprintf(stderr, "%s:%d: %s not found\n", script_name, script_line, argv[2]);
+	}
+	else if (!strcmp(argv[0], "xex") && argc == 2) {
+		uint8_t d = atoi(argv[1]);
+		uint16_t s = 0x171, k = 0;
+
+		read_sector(d, 1, NULL, "xex");
+		read_sector(d, 2, NULL, "xex");
+		while (s && k++ < 4096) {
+			if (read_sector(d, s, buf, "xex") < 128)
+				break;
+			s = (buf[125] << 8) | buf[126];
+		}
+	}
+	else
+		fprintf(stderr, "bad line: %s\n", argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *script;
+	char line[1024];
+	int sdhc = 1;
+	int i, n;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-v"))
+			sim_verbose = 1;
+		else if (!strcmp(argv[i], "-S"))
+			sdhc = 0;
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "csv"))
+				out_format = OUT_CSV;
+			else if (!strcmp(argv[i], "json"))
+				out_format = OUT_JSON;
+			else if (strcmp(argv[i], "text"))
+				break;
+		}
+		else
+			break;
+	}
+	if (argc - i < 2) {
+		fprintf(stderr, "usage: %s [-v] [-S] [-f text|csv|json] card.img script...\n", argv[0]);
+		return 1;
+	}
+	if (sd_open(argv[i], sdhc)) {
+		perror(argv[i]);
+		return 1;
+	}
+	if (out_format == OUT_CSV) {
+		printf("script,line,what,dev,cmd,aux,start_us,latency_us,answer,len,crc32,sd_read,sd_written");
+		for (n = 0; n < PH_MAX; n++)
+			printf(",%s_us", sim_phase_name[n]);
+		printf("\n");
+	}
+	sio_reset();
+	if (boot())
+		return 1;
+	// SDRIVE.ATR into D0:, as main() does
+	run_line(strcpy(line, "mount 0 SDRIVE.ATR"));
+
+	for (i++; i < argc; i++) {
+		script = fopen(argv[i], "r");
+		if (!script) {
+			perror(argv[i]);
+			return 1;
+		}
+		script_name = argv[i];
+		script_line = 0;
+		while (fgets(line, sizeof(line), script)) {
+			script_line++;
+			run_line(line);
+		}
+		fclose(script);
+	}
+	if (out_format != OUT_TEXT)
+		goto out;
+
+	printf("# total %.3f ms", sim_now / (F_CPU / 1000.0));
+	for (i = 0; i < PH_MAX; i++)
+		printf("  %s=%.3f", sim_phase_name[i], sim_phase_cycles[i] / (F_CPU / 1000.0));
+	printf("\n# sd: commands=%llu read=%llu written=%llu spi_bytes=%llu busy_violations=%llu\n",
+	       (unsigned long long)sd_stats.commands, (unsigned long long)sd_stats.blocks_read,
+	       (unsigned long long)sd_stats.blocks_written, (unsigned long long)sd_stats.spi_bytes,
+	       (unsigned long long)sd_stats.busy_violations);
+	printf("# cache: lines=%u hits=%lu misses=%lu writes=%lu\n", MMC_CACHE_SECTORS,
+	       (unsigned long)mmc_stats.hits, (unsigned long)mmc_stats.misses,
+	       (unsigned long)mmc_stats.writes);
+out:
+	sd_close();
+	return 0;
+}
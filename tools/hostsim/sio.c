@@ -0,0 +1,220 @@
+/* sio.c - SDrive host simulation: USART0 and the Atari side of the SIO bus
+ *
+ * usart.c is compiled unchanged against these registers.  UCSR0A and UDR0
+ * are accessor functions, so every poll advances the clock and a write to
+ * UDR0 is noticed on the next access to the simulated hardware.  The
+ * transmitter has the AVR layout: a one byte buffer (UDRE) in front of the
+ * shift register.
+ *
+ * The "Atari" asserts the command line, sends the command frame with the
+ * SIO t0/t1 timing, and for write commands sends the data frame t3 after
+ * the drive's ACK.
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include "global.h"
+#include "hostsim.h"
+
+#define UDR_EMPTY	0x1FF		// nothing written since the last look
+
+static volatile uint8_t ucsr0a_reg = _BV(UDRE0);
+static volatile uint16_t udr_cell = UDR_EMPTY;
+static volatile uint8_t pinc_reg = _BV(CMD_PIN);
+
+/* receiver: bytes on their way from the Atari */
+static uint8_t rxq[1100];
+static uint64_t rxq_time[1100];		// when the stop bit of the byte is in
+static uint16_t rxq_head, rxq_len;
+static uint64_t cmd_rise;		// command line goes high again
+
+/* pending data frame of a write command, sent after ACK */
+static uint8_t wdata[1025];
+static uint16_t wdata_len;
+static uint8_t wdata_armed;
+
+/* transmitter */
+static uint64_t tx_shift_end;		// shift register empty from then on
+static int16_t tx_buffered = -1;	// byte waiting in UDR
+static struct sio_result *res;
+static struct sio_result res_buf;
+
+uint32_t sio_baud(void)
+{
+	uint32_t div = (ucsr0a_reg & _BV(U2X0)) ? 8 : 16;
+
+	return F_CPU / (div * ((uint32_t)UBRR0 + 1));
+}
+
+static uint64_t byte_cycles(void)
+{
+	uint32_t div = (ucsr0a_reg & _BV(U2X0)) ? 8 : 16;
+
+	return 10ULL * div * ((uint64_t)UBRR0 + 1);	// start + 8 data + stop
+}
+
+static void tx_start(uint8_t b)
+{
+	uint64_t start = sim_now > tx_shift_end ? sim_now : tx_shift_end;
+
+	tx_shift_end = start + byte_cycles();
+	if (res->rx_len < sizeof(res->rx))
+		res->rx[res->rx_len++] = b;
+	else
+		res->rx_overflow = 1;
+	res->end = tx_shift_end;
+
+	// the Atari answers an ACK with the data frame of a write command
+	if (b == 'A' && wdata_armed) {
+		uint64_t t = tx_shift_end + HOSTSIM_US(SIM_SIO_T3_US);
+		uint16_t i;
+
+		wdata_armed = 0;
+		for (i = 0; i < wdata_len; i++) {
+			t += byte_cycles();
+			rxq[rxq_len] = wdata[i];
+			rxq_time[rxq_len] = t;
+			rxq_len++;
+		}
+	}
+}
+
+/* bring the USART model up to sim_now */
+void sio_sync(void)
+{
+	if (udr_cell < 0x100) {		// firmware wrote UDR0
+		if ((UCSR0B & _BV(TXEN0)) && res) {
+			if (tx_buffered >= 0)
+				;	// overrun of a full buffer: the AVR drops nothing, but the firmware never does this
+			else if (sim_now >= tx_shift_end)
+				tx_start(udr_cell);
+			else
+				tx_buffered = udr_cell;
+		}
+		udr_cell = UDR_EMPTY;
+	}
+	if (tx_buffered >= 0 && sim_now >= tx_shift_end) {
+		uint64_t now = sim_now;
+
+		sim_now = tx_shift_end;		// buffer moves on as soon as the shifter is free
+		tx_start(tx_buffered);
+		sim_now = now;
+		tx_buffered = -1;
+	}
+	ucsr0a_reg &= ~(_BV(RXC0) | _BV(UDRE0) | _BV(TXC0) | _BV(FE0) | _BV(DOR0));
+	if (tx_buffered < 0)
+		ucsr0a_reg |= _BV(UDRE0);
+	if (tx_buffered < 0 && sim_now >= tx_shift_end)
+		ucsr0a_reg |= _BV(TXC0);
+	if ((UCSR0B & _BV(RXEN0)) && rxq_head < rxq_len && sim_now >= rxq_time[rxq_head])
+		ucsr0a_reg |= _BV(RXC0);
+	if (res && sim_now >= cmd_rise)
+		pinc_reg |= _BV(CMD_PIN);
+}
+
+volatile uint8_t *hostsim_ucsr0a(void)
+{
+	uint8_t want;
+
+	sim_sync();
+	// a polling loop spends its time waiting for whichever side is busy
+	want = ucsr0a_reg;
+	sim_advance(SIM_USART_POLL_CYCLES, (want & _BV(UDRE0)) ? PH_RX : PH_TX);
+	return &ucsr0a_reg;
+}
+
+volatile uint16_t *hostsim_udr0(void)
+{
+	sim_sync();
+	if (ucsr0a_reg & _BV(RXC0)) {	// a read: hand out the next byte
+		udr_cell = 0x100 | rxq[rxq_head++];
+		if (rxq_head == rxq_len)
+			rxq_head = rxq_len = 0;
+		ucsr0a_reg &= ~_BV(RXC0);
+	}
+	return &udr_cell;
+}
+
+volatile uint8_t *hostsim_pinc(void)
+{
+	sim_advance(SIM_USART_POLL_CYCLES, PH_RX);
+	return &pinc_reg;
+}
+
+/* the firmware sums frames while they come in or go out, only the bulk
+ * users of get_checksum() (tape) pay for a pass over the buffer; linked
+ * with --wrap, calls from other files than usart.c come here */
+unsigned char __real_get_checksum(unsigned char *buffer, uint16_t len);
+
+unsigned char __wrap_get_checksum(unsigned char *buffer, uint16_t len)
+{
+	sim_advance((uint64_t)SIM_CKSUM_CYCLES * len, PH_CKSUM);
+	return __real_get_checksum(buffer, len);
+}
+
+void sio_reset(void)
+{
+	rxq_head = rxq_len = 0;
+	wdata_armed = 0;
+	tx_buffered = -1;
+	udr_cell = UDR_EMPTY;
+	pinc_reg |= _BV(CMD_PIN);
+	res = &res_buf;
+	memset(res, 0, sizeof(*res));
+}
+
+void sio_begin_command(uint8_t dev, uint8_t cmd, uint8_t aux1, uint8_t aux2,
+		       const uint8_t *data, uint16_t data_len)
+{
+	uint8_t frame[5] = { dev, cmd, aux1, aux2, 0 };
+	uint64_t t;
+	uint16_t i, s;
+	uint8_t j;
+
+	sio_reset();
+	res->start = sim_now;
+	res->end = sim_now;
+
+	for (s = 0, i = 0; i < 4; i++) {
+		s += frame[i];
+		if (s > 0xFF)
+			s = (s & 0xFF) + 1;
+	}
+	frame[4] = s;
+
+	rxq_head = rxq_len = 0;
+	t = sim_now + HOSTSIM_US(SIM_SIO_T0_US);
+	for (j = 0; j < 5; j++) {
+		t += byte_cycles();
+		rxq[rxq_len] = frame[j];
+		rxq_time[rxq_len] = t;
+		rxq_len++;
+	}
+	cmd_rise = t + HOSTSIM_US(SIM_SIO_T1_US);
+	pinc_reg &= ~_BV(CMD_PIN);
+
+	wdata_len = 0;
+	wdata_armed = 0;
+	if (data && data_len) {
+		memcpy(wdata, data, data_len);
+		for (s = 0, i = 0; i < data_len; i++) {
+			s += data[i];
+			if (s > 0xFF)
+				s = (s & 0xFF) + 1;
+		}
+		wdata[data_len] = s;
+		wdata_len = data_len + 1;
+		wdata_armed = 1;
+	}
+}
+
+/* command is done: let the transmitter drain and hand out the result */
+void sio_finish(struct sio_result *r)
+{
+	sim_sync();
+	// after reti the UDRE interrupt sends what the firmware queued
+	while ((UCSR0B & _BV(UDRIE0)) || tx_buffered >= 0 || sim_now < tx_shift_end)
+		sim_advance(tx_shift_end > sim_now ? tx_shift_end - sim_now : 1, PH_TX);
+	pinc_reg |= _BV(CMD_PIN);
+	*r = *res;
+}
@@ -75,19 +75,47 @@ void waitTouch() {
 	restorePorts();
 }
 
-char isTouching() {
-	cli();		// no interrupts during change of port directions!
-	setIdling();
-	char ret=!(XM_PIN & (1<<XM));	// read press condition(TRUE when LOW)
+// The lines of the panel are those of the display, and the Atari command
+// interrupt draws.  So nothing here runs with interrupts off: an
+// interrupt, that wants to draw, calls touchAbort() first, which puts the
+// ports back, and the reading is done again.
+
+static volatile u08 ts_lines;	// 1: the lines are set up for the panel
+
+void touchAbort() {
+	if(ts_lines) {
+		restorePorts();
+		ts_lines = 0;
+	}
+}
+
+// ports back for the display, 0 if an interrupt was in between
+static u08 touchRelease() {
+	u08 ok;
+
 	restorePorts();
-	sei();
+	ok = ts_lines;
+	ts_lines = 0;
+	return ok;
+}
+
+char isTouching() {
+	char ret;
+
+	do {
+		ts_lines = 1;
+		setIdling();
+		ret=!(XM_PIN & (1<<XM));	// read press condition(TRUE when LOW)
+	} while(!touchRelease());
 	return ret;
 }
 
+#define TOUCH_ABORTED	0xffff		// no reading, the ADC has 10 bits
+
 uint16_t readTouch(uint8_t b) {
-	// A/D-converter enable, no irq, prescaler 128 -> 125 KHz
-	ADCSRA=0x87;
+	u08 ok;
 
+	ts_lines = 1;
 	if (b) {					// Y messure
 		XM_DDR &=~(1<<XM); XM_PORT &=~(1<<XM);	// X- = Z
 		YM_DDR |= (1<<YM); YM_PORT &=~(1<<YM);	// Y- = L
@@ -104,42 +132,110 @@ uint16_t readTouch(uint8_t b) {
 	}
 	_delay_us(0.5);
 	ADCSRA |= (1<<ADSC);		// A/D-converter start
+	_delay_us(16);			// input is held after 1.5 ADC clocks (12 us)
+	ok = touchRelease();		// the display may have the lines again
 	while (ADCSRA&(1<<ADSC));	// wait until ready
 	uint16_t ret=ADC;
-	//restorePorts();
-	return ret;
+	return ok ? ret : TOUCH_ABORTED;
 }
 
-struct TSPoint p;
+void touchInit() {
+	// A/D-converter enable, no irq, prescaler 128 -> 125 KHz
+	ADCSRA=0x87;
+	ADCSRA |= (1<<ADSC);		// the first conversion takes longer
+	while (ADCSRA&(1<<ADSC));
+	// timer 0 gives the pace of the sampling, CTC mode, clk/256
+	TCCR0A = (1<<WGM01);
+	TCCR0B = (1<<CS02);
+	OCR0A = TOUCH_TICK;
+}
 
-struct TSPoint getPoint () {
-	cli();			//disable interrupts
-	setIdling();
-#if defined(HX8347G)
-	p.x = map(readTouch(1), TS_MINX, TS_MAXX, 0, MAX_X);
-	p.y = map(readTouch(0), TS_MINY, TS_MAXY, 0, MAX_Y);
-#else
-	p.x = map(readTouch(0), TS_MINX, TS_MAXX, 0, MAX_X);
-	p.y = map(readTouch(1), TS_MINY, TS_MAXY, 0, MAX_Y);
-#endif
-	restorePorts();
-	sei();
-	return(p);
+// Sampling: touchPoll() does one step of it, when timer 0 has counted a
+// tick.  A touch is TOUCH_SAMPLES readings of each axis (one pair a step)
+// with pressure before and after; the two readings in the middle count,
+// if they are close enough.  After that the panel has to be free for
+// TOUCH_RELEASE steps (debounce), before the next touch is taken.
+
+#define TS_IDLE		0
+#define TS_SAMPLE	1
+#define TS_HELD		2
+
+static u08 ts_state, ts_n;
+static u16 ts_x[TOUCH_SAMPLES], ts_y[TOUCH_SAMPLES];
+static struct TSPoint ts_raw;	// last touch, ADC values
+
+// the middle of the readings, TOUCH_ABORTED if they scatter too much
+static uint16_t touchFilter(u16 *v) {
+	u08 i, j;
+	u16 t;
+
+	for(i = 1; i < TOUCH_SAMPLES; i++)	// sort
+		for(j = i; j && v[j-1] > v[j]; j--) {
+			t = v[j]; v[j] = v[j-1]; v[j-1] = t;
+		}
+	v += TOUCH_SAMPLES/2-1;
+	if(v[1] - v[0] > TOUCH_NOISE)
+		return TOUCH_ABORTED;
+	return (v[0] + v[1]) / 2;
 }
 
-struct TSPoint getRawPoint () {
-	cli();
-	setIdling();
+char touchPoll() {
+	if(!(TIFR0 & (1<<OCF0A)))	// not yet time for the next step
+		return 0;
+	TIFR0 = (1<<OCF0A);
 
+	switch(ts_state) {
+		case TS_IDLE:
+			if(isTouching()) {
+				ts_state = TS_SAMPLE;
+				ts_n = 0;
+			}
+			break;
+
+		case TS_SAMPLE:
 #if defined(HX8347G)
-	p.x = readTouch(1);
-	p.y = readTouch(0);
+			ts_x[ts_n] = readTouch(1);
+			ts_y[ts_n] = readTouch(0);
 #else
-	p.x = readTouch(0);
-	p.y = readTouch(1);
+			ts_x[ts_n] = readTouch(0);
+			ts_y[ts_n] = readTouch(1);
 #endif
+			if(ts_x[ts_n] == TOUCH_ABORTED || ts_y[ts_n] == TOUCH_ABORTED)
+				break;		// again at the next tick
+			if(++ts_n < TOUCH_SAMPLES)
+				break;
+			ts_n = 0;
+			if(!isTouching()) {	// released while measuring
+				ts_state = TS_IDLE;
+				break;
+			}
+			ts_raw.x = touchFilter(ts_x);
+			ts_raw.y = touchFilter(ts_y);
+			if(ts_raw.x == TOUCH_ABORTED || ts_raw.y == TOUCH_ABORTED)
+				break;		// once more
+			ts_state = TS_HELD;
+			return 1;
+
+		case TS_HELD:
+			if(isTouching())
+				ts_n = 0;
+			else if(++ts_n >= TOUCH_RELEASE)
+				ts_state = TS_IDLE;
+	}
+	return 0;
+}
 
-	restorePorts();
-	sei();
+struct TSPoint p;
+
+struct TSPoint getPoint () {	// the last touch, on the screen
+	p.x = map(ts_raw.x, TS_MINX, TS_MAXX, 0, MAX_X);
+	p.y = map(ts_raw.y, TS_MINY, TS_MAXY, 0, MAX_Y);
+	return(p);
+}
+
+struct TSPoint getRawPoint () {	// the next touch, ADC values
+	ts_state = TS_IDLE;
+	while(!touchPoll());
+	p = ts_raw;
 	return(p);
 }
@@ -51,6 +51,19 @@
 
 #endif
 
+#ifndef TOUCH_TICK
+#define TOUCH_TICK	124	// timer 0 (clk/256) between two sampling steps, 2 ms
+#endif
+#ifndef TOUCH_SAMPLES
+#define TOUCH_SAMPLES	4	// readings of each axis for one touch (even)
+#endif
+#ifndef TOUCH_NOISE
+#define TOUCH_NOISE	8	// max. ADC steps between the two in the middle
+#endif
+#ifndef TOUCH_RELEASE
+#define TOUCH_RELEASE	25	// steps without pressure for a release, 50 ms
+#endif
+
 struct TSPoint {
 	unsigned int x;
 	unsigned int y;
@@ -58,6 +71,9 @@ struct TSPoint {
 
 void restorePorts();
 void waitTouch();
+void touchInit();
+char touchPoll();
+void touchAbort();
 char isTouching();
 //uint16_t readTouch(uint8_t b);
 struct TSPoint getPoint();
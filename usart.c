@@ -5,6 +5,7 @@
 //*****************************************************************************
 
 #include <avr/io.h>		// include I/O definitions (port names, pin names, etc)
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include <avr/pgmspace.h>
 #include "usart.h"
@@ -22,12 +23,14 @@ extern void sio_debug(char status);
 	#define UCSRB	UCSR0B
 	#define UCSRC	UCSR0C
 	#define UDRE	UDRE0
+	#define TXC	TXC0
 	#define RXEN	RXEN0
 	#define TXEN	TXEN0
 	#define URSEL	0		// does not exist
 	#define UCSZ0	UCSZ00
 	#define UCSZ1	UCSZ01
 	#define U2X	U2X0
+	#define UDRIE	UDRIE0
 	#define RXC	RXC0
 	#define UDR	UDR0
 	#define FE	FE0
@@ -37,34 +40,160 @@ extern void sio_debug(char status);
 extern unsigned char atari_sector_buffer[256];
 //extern unsigned char last_key;
 
+//transmit queue, sent by the UDRE interrupt (or by USART_Wait_Tx() while
+//interrupts are off, e.g. inside process_command)
+struct usart_tx_block {
+	const u08 *ptr;
+	u16 len;
+	u08 checksum;		//append the SIO checksum
+};
+static volatile struct usart_tx_block usart_tx_queue[USART_TX_QUEUE];
+static volatile u08 usart_tx_sum;	//checksum of the frame so far, over blocks without one
+static volatile u08 usart_tx_head, usart_tx_count;
+static void (* volatile usart_tx_done)(void);
+static volatile u08 usart_tx_shifting;	//last byte is in UDR, TXC tells when it is out
+
+//UDR got the last byte for now, TXC is set again when it has left
+static inline void usart_tx_last(void)
+{
+	UCSRA = (UCSRA & (1<<U2X)) | (1<<TXC);	//writing 1 clears TXC
+	usart_tx_shifting = 1;
+}
+
+//SIO checksum: sum with end-around carry
+static inline u08 checksum_add(u08 sum, u08 b)
+{
+#ifdef __AVR__
+	asm ("add %0,%1" "\n\t"
+	     "adc %0,__zero_reg__"
+	     : "+r" (sum) : "r" (b));
+	return sum;
+#else
+	sum += b;
+	return (sum < b) ? sum+1 : sum;
+#endif
+}
+
+//next byte of the queue to UDR, UDR must be empty
+static inline void usart_tx_next(void)
+{
+	volatile struct usart_tx_block *b = &usart_tx_queue[usart_tx_head];
+	void (*done)(void);
+	u08 c;
+
+	if (b->len) {
+		c = *b->ptr++;
+		UDR = c;
+		usart_tx_sum = checksum_add(usart_tx_sum, c);
+		if (--b->len || b->checksum) return;
+	}
+	else {
+		UDR = usart_tx_sum;	//checksum behind the data
+		usart_tx_sum = 0;
+	}
+	usart_tx_head = (usart_tx_head+1) % USART_TX_QUEUE;
+	if (--usart_tx_count) return;
+	UCSRB &= ~(1<<UDRIE);	//queue empty
+	usart_tx_last();
+	done = usart_tx_done;
+	usart_tx_done = 0;
+	if (done) done();
+}
+
+ISR(USART_UDRE_vect)
+{
+	usart_tx_next();
+}
+
+//serve the queue while the interrupt can not
+//(UCSRA first, so a wait with interrupts on is a polling loop too)
+static void USART_Tx_Poll(void)
+{
+	if ( (UCSRA & (1<<UDRE)) && !(SREG & (1<<SREG_I)) && usart_tx_count )
+		usart_tx_next();
+}
+
+void USART_Wait_Tx(void)
+{
+	while (usart_tx_count) USART_Tx_Poll();
+}
+
+void USART_Send_Block(const unsigned char *buff, u16 len, u08 checksum)
+{
+	u08 sreg, i;
+
+	if (!len && !checksum) return;
+	while (usart_tx_count == USART_TX_QUEUE) USART_Tx_Poll();	//both buffers busy
+	sreg = SREG;
+	cli();
+	i = (usart_tx_head+usart_tx_count) % USART_TX_QUEUE;
+	usart_tx_queue[i].ptr = buff;
+	usart_tx_queue[i].len = len;
+	usart_tx_queue[i].checksum = checksum;
+	usart_tx_count++;
+	UCSRB |= (1<<UDRIE);
+	SREG = sreg;
+}
+
+void USART_Tx_Callback(void (*done)(void))
+{
+	u08 sreg = SREG;
+
+	cli();
+	if (usart_tx_count)
+		usart_tx_done = done;
+	else if (done)
+		done();		//nothing queued, done already
+	SREG = sreg;
+}
+
 unsigned char get_checksum (unsigned char* buffer, u16 len) {
+#ifdef __AVR__
+	u08 sum=0;
+	u08 b;
+
+	if (!len) return 0;
+	asm volatile (
+		"1:	ld	%[b],%a[p]+"		"\n\t"
+		"	add	%[sum],%[b]"		"\n\t"
+		"	adc	%[sum],__zero_reg__"	"\n\t"	//end-around carry
+		"	sbiw	%[n],1"			"\n\t"
+		"	brne	1b"
+		: [sum] "+r" (sum), [b] "=&r" (b), [p] "+e" (buffer), [n] "+w" (len)
+		:
+		: "memory");
+	return sum;
+#else
 	u16 i;
-	u08 sumo,sum;
-	sum=sumo=0;
+	u08 sum=0;
 	for(i=0;i<len;i++)
-	{
-		sum+=buffer[i];
-		if(sum<sumo) sum++;
-		sumo = sum;
-	}
+		sum = checksum_add(sum, buffer[i]);
 	return sum;
+#endif
 }
 
 void USART_Init ( u16 value ) {
-	/* Wait for empty transmit buffer */
+	/* Wait for empty transmit queue and buffer */
+	USART_Wait_Tx();
 	while ( !( UCSRA & (1<<UDRE)) ); //cekani
+	/* and for the last byte to leave, a new speed would garble it */
+	if (usart_tx_shifting)
+		while ( !( UCSRA & (1<<TXC)) );
+	usart_tx_shifting = 0;
 
 	/* Set baud rate */
 #if defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
-	UBRR0 = value;
+	UBRR0 = value & ~USART_1X;
 #else
-	UBRRH = value >> 8;
+	UBRRH = (value & ~USART_1X) >> 8;
 	UBRRL = value & 0xff;
 #endif
 
 	/* Set double speed flag */
-	UCSRA = (1<<UDRE)|(1<<U2X); //double speed
-	//UCSRA = (1<<UDRE);
+	if (value & USART_1X)
+		UCSRA = (1<<UDRE);
+	else
+		UCSRA = (1<<UDRE)|(1<<U2X); //double speed
 
 	/* Enable Receiver and Transmitter */
 	UCSRB = (1<<RXEN)|(1<<TXEN);
@@ -83,11 +212,13 @@ void USART_Flush() {
 }
 
 void USART_Transmit_Byte( unsigned char data ) {
-	/* Wait for empty transmit buffer */
+	/* Wait for empty transmit queue and buffer */
+	USART_Wait_Tx();
 	while ( !( UCSRA & (1<<UDRE)) )	;
 
 	/* Put data into buffer, sends the data */
 	UDR = data;
+	usart_tx_last();
 }
 
 unsigned char USART_Receive_Byte( void ) {
@@ -112,6 +243,7 @@ u08 USART_Get_Buffer_And_Check(unsigned char *buff, u16 len, u08 cmd_state) {
 	u08 *ptr;
 	u16 n;
 	u08 b;
+	u08 sum=0;	//checksum on the fly, so the answer can follow the last byte
 	ptr=buff;
 	n=len;
 	unsigned long timeout = 0;
@@ -136,10 +268,11 @@ u08 USART_Get_Buffer_And_Check(unsigned char *buff, u16 len, u08 cmd_state) {
 		if (!n)
 		{
 			//v b je checksum (n+1 byte)
-			if ( b!=get_checksum(buff,len) ) return 0x80;	//chyba checksumu
+			if ( b!=sum ) return 0x80;	//chyba checksumu
 			return 0x00; //ok
 		}
 		*ptr++=b;
+		sum=checksum_add(sum,b);
 		n--;
 	}
 }
@@ -171,9 +304,7 @@ u08 USART_Get_buffer_and_check_and_send_ACK_or_NACK(unsigned char *buff, u16 len
 	return 0;	//kdyz je ok vraci 0
 }
 
-void USART_Send_atari_sector_buffer_and_check_sum(unsigned short len, unsigned char status) {
-	u08 check_sum;
-
+void USART_Send_Data_and_check_sum(const unsigned char *buff, u16 len, const unsigned char *buff2, u16 len2, unsigned char status) {
 	//	Delay300us();	//po ACKu pred CMPL pauza 250us - 255sec
 	//Kdyz bylo jen 300us tak nefungovalo
 	//_delay_us(800);	//t5
@@ -196,7 +327,12 @@ void USART_Send_atari_sector_buffer_and_check_sum(unsigned short len, unsigned c
 	//Delay800us();	//t6
 	_delay_us(200);	//<--pouziva se i u commandu 3F
 
-	USART_Send_Buffer(atari_sector_buffer,len);
-	check_sum = get_checksum(atari_sector_buffer,len);
-	USART_Transmit_Byte(check_sum);
+	//the frame goes out in background, checksummed on the way,
+	//the buffers must stay untouched until USART_Wait_Tx()
+	if (len2) {
+		USART_Send_Block(buff,len,0);	//the checksum goes on over buff2
+		USART_Send_Block(buff2,len2,1);
+	}
+	else
+		USART_Send_Block(buff,len,1);
 }
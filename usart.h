@@ -23,6 +23,14 @@
 #define get_cmd_H()             ( inb(CMD_PORT) & (1<<CMD_PIN) )
 #define get_cmd_L()             ( !(inb(CMD_PORT) & (1<<CMD_PIN)) )
 
+// blocks queued for the transmit interrupt, 2 = double buffered
+#ifndef USART_TX_QUEUE
+#define USART_TX_QUEUE	2
+#endif
+
+// USART_Init() value: UBRR, U2X=1 unless USART_1X is added
+#define USART_1X	0x8000
+
 unsigned char get_checksum(unsigned char* buffer, u16 len);
 
 //prototypes
@@ -31,10 +39,15 @@ void USART_Flush();
 void USART_Transmit_Byte( unsigned char data );
 unsigned char USART_Receive_Byte( void );
 void USART_Send_Buffer(unsigned char *buff, u16 len);
+void USART_Send_Block(const unsigned char *buff, u16 len, u08 checksum);	//queue, returns at once, without checksum the next block continues the frame
+void USART_Wait_Tx(void);					//until the queue is sent
+void USART_Tx_Callback(void (*done)(void));			//call done when the queue is sent
 u08 USART_Get_Buffer_And_Check(unsigned char *buff, u16 len, u08 cmd_state);
 u08 USART_Get_buffer_and_check_and_send_ACK_or_NACK(unsigned char *buff, u16 len);
 //void USART_Send_cmpl_and_atari_sector_buffer_and_check_sum(unsigned short len);
-void USART_Send_atari_sector_buffer_and_check_sum(unsigned short len, unsigned char status);
+void USART_Send_Data_and_check_sum(const unsigned char *buff, u16 len, const unsigned char *buff2, u16 len2, unsigned char status);	//frame in one or two pieces
+
+#define USART_Send_atari_sector_buffer_and_check_sum(len, status) USART_Send_Data_and_check_sum(atari_sector_buffer, len, 0, 0, status)
 
 #define USART_Send_ERR_and_atari_sector_buffer_and_check_sum(len) USART_Send_atari_sector_buffer_and_check_sum(len, 1)
 #define USART_Send_cmpl_and_atari_sector_buffer_and_check_sum(len) USART_Send_atari_sector_buffer_and_check_sum(len, 0)